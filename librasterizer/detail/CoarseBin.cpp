@@ -0,0 +1,10 @@
+#include "CoarseBin.hpp"
+
+namespace rasterizer {
+
+glm::uvec2 CoarseBin::computeGridDim(glm::uvec2 screenSize) noexcept
+{
+	return (screenSize - glm::uvec2(1)) / glm::uvec2(kSize) + glm::uvec2(1);
+}
+
+}
\ No newline at end of file
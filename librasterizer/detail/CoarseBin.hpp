@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "glm-include.hpp"
+
+namespace rasterizer {
+
+//A macro-tile of the screen. Triangles get binned here first, then the worker owning the bin distributes them among its fine tiles.
+//The bins don't store triangles themselves. Each bin is a range of the shared buffer of triangle ids, laid out by a prefix sum
+//over the per-bin counts. It's also the unit of work past the binning: a bin gets rasterized and post-processed on its own.
+struct CoarseBin
+{
+	static constexpr size_t kSize = 64;
+	template <typename TTile>
+	static constexpr size_t kTiles = kSize / TTile::kSize;
+
+	//The bin's way through a frame. Every chunk of triangles publishes its entries of the bin at once when they're written,
+	//the bin is ready to rasterize once all of them are. A cache line each, as a chunk publishes to neighboring bins
+	//back to back. Lives in the frame arena, so it must stay trivially destructible.
+	struct alignas(64) Progress
+	{
+		uint32_t entries;				// counted before the writes start
+		std::atomic_uint32_t written;
+		std::atomic_bool taken;			// by a worker rasterizing it
+	};
+
+	size_t firstEntry;
+	size_t lastEntry;
+
+	static glm::uvec2 computeGridDim(glm::uvec2 screenSize) noexcept;
+};
+
+}
\ No newline at end of file
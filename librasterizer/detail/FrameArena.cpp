@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <atomic>
+
+#include "FrameArena.hpp"
+
+namespace rasterizer {
+
+static uint64_t nextArenaId() noexcept
+{
+	static std::atomic<uint64_t> counter{ 0 };
+	return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+FrameArena::FrameArena() noexcept : m_id(nextArenaId())
+{
+}
+
+FrameArena::ThreadChunks& FrameArena::threadChunks()
+{
+	//the arena ids are never reused, so a stale entry left by a destroyed or released arena can't match
+	struct CacheEntry
+	{
+		uint64_t arenaId;
+		ThreadChunks* chunks;
+	};
+	thread_local CacheEntry cache{ 0, nullptr };
+
+	if (cache.arenaId == m_id)
+		return *cache.chunks;
+
+	std::lock_guard lock(m_threadsMutex);
+
+	const auto self = std::this_thread::get_id();
+	auto found = std::find_if(m_threads.begin(), m_threads.end(), [self](const auto& thread) { return thread->owner == self; });
+	if (found == m_threads.end())
+	{
+		m_threads.emplace_back(std::make_unique<ThreadChunks>());
+		m_threads.back()->owner = self;
+		found = std::prev(m_threads.end());
+	}
+
+	cache = { m_id, found->get() };
+	return **found;
+}
+
+void* FrameArena::allocateBytes(size_t size, size_t alignment)
+{
+	auto& thread = threadChunks();
+
+	if (thread.generation != m_generation)
+	{
+		thread.generation = m_generation;
+		thread.current = 0;
+		thread.offset = 0;
+		thread.used = 0;
+	}
+
+	//the chunks of the previous frames get reused in the same order, a request too big for one of them skips it
+	for (; thread.current != thread.chunks.size(); ++thread.current, thread.offset = 0)
+	{
+		auto& chunk = thread.chunks[thread.current];
+		const auto base = reinterpret_cast<uintptr_t>(chunk.memory.get());
+		const auto aligned = (base + thread.offset + alignment - 1) / alignment * alignment;
+
+		if (aligned + size <= base + chunk.size)
+		{
+			thread.offset = aligned + size - base;
+			thread.used += size;
+			return reinterpret_cast<void*>(aligned);
+		}
+	}
+
+	//operator new[] aligns to max_align_t only, the padding leaves room for the over-aligned types (a cache line)
+	const auto chunkSize = std::max(kChunkSize, size + alignment - 1);
+	thread.chunks.push_back({ std::make_unique<std::byte[]>(chunkSize), chunkSize });
+
+	const auto base = reinterpret_cast<uintptr_t>(thread.chunks.back().memory.get());
+	const auto aligned = (base + alignment - 1) / alignment * alignment;
+	thread.offset = aligned + size - base;
+	thread.used += size;
+	return reinterpret_cast<void*>(aligned);
+}
+
+void FrameArena::reset() noexcept
+{
+	m_highWaterMark = std::max(m_highWaterMark, usedBytes());
+	m_generation++;
+}
+
+size_t FrameArena::usedBytes() const noexcept
+{
+	std::lock_guard lock(m_threadsMutex);
+	size_t result = 0;
+	for (const auto& thread : m_threads)
+		if (thread->generation == m_generation)
+			result += thread->used;
+	return result;
+}
+
+size_t FrameArena::highWaterMark() const noexcept
+{
+	return std::max(m_highWaterMark, usedBytes());
+}
+
+void FrameArena::release() noexcept
+{
+	m_highWaterMark = std::max(m_highWaterMark, usedBytes());
+
+	//a new id makes the threads still caching the freed chunks look them up again
+	std::lock_guard lock(m_threadsMutex);
+	m_threads.clear();
+	m_id = nextArenaId();
+}
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace rasterizer {
+
+//A linear allocator for the scratch data living within a single frame.
+//Every thread bumps a pointer in its own chunks, so the workers never contend for the allocator.
+//reset() only advances the generation, each thread rewinds its chunks lazily on its next allocation.
+//Nothing gets freed between the frames, so once the arena is warm a frame costs no heap allocations and no page faults.
+class FrameArena final
+{
+public:
+	static constexpr size_t kChunkSize = 64 * 1024;
+
+	FrameArena() noexcept;
+	FrameArena(const FrameArena&) = delete;
+	FrameArena(FrameArena&&) = delete;
+	~FrameArena() = default;
+
+	FrameArena& operator= (const FrameArena&) = delete;
+	FrameArena& operator= (FrameArena&&) = delete;
+
+	//uninitialized storage valid until the next reset, thread-safe
+	template <typename T>
+	T* allocate(size_t count);
+
+	//invalidates everything allocated so far, not thread-safe against allocations
+	void reset() noexcept;
+	//bytes allocated since the last reset
+	size_t usedBytes() const noexcept;
+	//the most bytes a frame has allocated so far
+	size_t highWaterMark() const noexcept;
+	//frees the chunks of every thread, for when the threads allocating from the arena get replaced,
+	//not thread-safe against allocations
+	void release() noexcept;
+
+private:
+	struct Chunk
+	{
+		std::unique_ptr<std::byte[]> memory;
+		size_t size;
+	};
+
+	struct ThreadChunks
+	{
+		std::thread::id owner;
+		std::vector<Chunk> chunks;
+		size_t current{ 0 };
+		size_t offset{ 0 };
+		size_t used{ 0 };
+		uint64_t generation{ 0 };
+	};
+
+	uint64_t m_id;					// unique across the arenas and their releases, the thread-local cache is keyed by it
+	uint64_t m_generation{ 1 };
+	size_t m_highWaterMark{ 0 };
+
+	mutable std::mutex m_threadsMutex;	// taken only when a thread allocates from the arena for the first time
+	std::vector<std::unique_ptr<ThreadChunks>> m_threads;
+
+	ThreadChunks& threadChunks();
+	void* allocateBytes(size_t size, size_t alignment);
+};
+
+template <typename T>
+T* FrameArena::allocate(size_t count)
+{
+	static_assert(std::is_trivially_destructible_v<T>, "the arena never runs destructors");
+	return static_cast<T*>(allocateBytes(count * sizeof(T), alignof(T)));
+}
+
+}
@@ -0,0 +1,194 @@
+#include "JobSystem.hpp"
+
+namespace rasterizer {
+
+namespace {
+
+//the pool the current thread works for and its queue there
+struct WorkerIdentity
+{
+	const JobSystem* system;
+	size_t queue;
+};
+thread_local WorkerIdentity t_worker{ nullptr, 0 };
+
+}
+
+JobSystem::~JobSystem()
+{
+	stop();
+}
+
+void JobSystem::resize(unsigned workers)
+{
+	if (workers == m_workers.size() && m_queues)
+		return;
+
+	stop();
+
+	m_queuesCount = size_t(workers) + 1;
+	m_queues = std::make_unique<Queue[]>(m_queuesCount);
+	m_stopping = false;
+
+	m_workers.reserve(workers);
+	for (size_t queue = 0; queue != workers; ++queue)
+		m_workers.emplace_back([this, queue] { workerLoop(queue); });
+}
+
+unsigned JobSystem::concurrency() const noexcept
+{
+	return unsigned(m_workers.size()) + 1;
+}
+
+unsigned JobSystem::currentThread() const noexcept
+{
+	return unsigned(currentQueue());
+}
+
+void JobSystem::stop() noexcept
+{
+	{
+		std::lock_guard lock(m_sleepMutex);
+		m_stopping = true;
+	}
+	m_wakeUp.notify_all();
+
+	for (auto& worker : m_workers)
+		worker.join();
+	m_workers.clear();
+}
+
+void JobSystem::workerLoop(size_t queue) noexcept
+{
+	t_worker = { this, queue };
+
+	//a few rounds of spinning first, the next loop of the frame usually comes right away
+	constexpr size_t kSpins = 64;
+
+	for (;;)
+	{
+		if (runOne(queue))
+			continue;
+
+		for (size_t spin = 0; spin != kSpins && m_queued.load(std::memory_order_relaxed) == 0; ++spin)
+			std::this_thread::yield();
+
+		if (m_queued.load() != 0)
+			continue;
+
+		std::unique_lock lock(m_sleepMutex);
+		m_sleeping++;
+		m_wakeUp.wait(lock, [&] { return m_stopping || m_queued.load() != 0; });
+		m_sleeping--;
+
+		if (m_stopping)
+			return;
+	}
+}
+
+size_t JobSystem::currentQueue() const noexcept
+{
+	return t_worker.system == this ? t_worker.queue : m_queuesCount - 1;
+}
+
+void JobSystem::push(size_t queue, const Task& task)
+{
+	{
+		std::lock_guard lock(m_queues[queue].mutex);
+		m_queues[queue].tasks.push_back(task);
+	}
+
+	//A sleeper counts itself under the mutex before checking the queued tasks, and here the order is the opposite.
+	//So either it sees the new task, or the notification comes after it has started waiting.
+	m_queued++;
+	if (m_sleeping.load() != 0)
+	{
+		std::lock_guard lock(m_sleepMutex);
+		m_wakeUp.notify_one();
+	}
+}
+
+bool JobSystem::pop(size_t queue, Task& task) noexcept
+{
+	//the own queue from the back, where the smallest and most recently split ranges are
+	{
+		auto& own = m_queues[queue];
+		std::lock_guard lock(own.mutex);
+		if (!own.tasks.empty())
+		{
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			m_queued--;
+			return true;
+		}
+	}
+
+	//the others' from the front, where their biggest ranges are
+	for (size_t offset = 1; offset != m_queuesCount; ++offset)
+	{
+		auto& victim = m_queues[(queue + offset) % m_queuesCount];
+		std::lock_guard lock(victim.mutex);
+		if (!victim.tasks.empty())
+		{
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			m_queued--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool JobSystem::runOne(size_t queue)
+{
+	if (m_queued.load(std::memory_order_relaxed) == 0)
+		return false;
+
+	Task task;
+	if (!pop(queue, task))
+		return false;
+
+	execute(queue, task);
+	return true;
+}
+
+void JobSystem::execute(size_t queue, Task task)
+{
+	auto& job = *task.job;
+	while (task.end - task.begin > job.grain)
+	{
+		const auto middle = task.begin + (task.end - task.begin) / 2;
+		push(queue, { &job, middle, task.end });
+		task.end = middle;
+	}
+
+	job.run(*this, job, task.begin, task.end);
+	job.remaining.fetch_sub(task.end - task.begin, std::memory_order_acq_rel);
+}
+
+void JobSystem::runAndWait(Job& job, size_t count)
+{
+	const auto queue = currentQueue();
+	execute(queue, { &job, 0, count });
+
+	//the rest of the job is split among the queues, helping out beats sleeping as the job ends soon
+	while (job.remaining.load(std::memory_order_acquire) != 0)
+	{
+		if (!runOne(queue))
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::spawn(Job& job, size_t begin, size_t end)
+{
+	if (begin == end)
+		return;
+
+	//The spawning task is yet to count itself done, so the job can't look finished before the new range is added.
+	//The range gets to the thread running it through the queue's mutex, which orders the add before its done count.
+	job.remaining.fetch_add(end - begin, std::memory_order_relaxed);
+	push(currentQueue(), { &job, begin, end });
+}
+
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rasterizer {
+
+//A persistent pool of threads the pipeline stages dispatch their loops into.
+//Every worker owns a deque of tasks, each task being a range of indices. A worker splits the range it runs in halves
+//down to the grain, keeps the left half and pushes the right one, so the deque holds bigger ranges the closer to its front.
+//The owner pops from the back while it's busy with its own hot data, the idle workers steal from the front, taking
+//the biggest pieces left. The threads outlive the frames, so a loop costs no thread spawning, only a wake-up of the idle ones.
+class JobSystem final
+{
+public:
+	JobSystem() noexcept = default;
+	JobSystem(const JobSystem&) = delete;
+	JobSystem(JobSystem&&) = delete;
+	~JobSystem();
+
+	JobSystem& operator= (const JobSystem&) = delete;
+	JobSystem& operator= (JobSystem&&) = delete;
+
+	//stops the current workers and starts the given number of them, not thread-safe against the loops
+	void resize(unsigned workers);
+	//the threads running a loop: the workers and the thread waiting for it, which joins in
+	unsigned concurrency() const noexcept;
+	//the calling thread's index below concurrency(), the threads outside the pool share the last one
+	unsigned currentThread() const noexcept;
+
+	//Calls `func(idx)` for every idx in [0, count) and returns once all of them are done. A task runs at least `grain`
+	//indices unless the range is shorter, so the grain trades the dispatch overhead for the balance between the workers.
+	//The loops may nest or come from several threads at once, a waiting thread runs the tasks of any loop meanwhile.
+	//`func` must not throw.
+	template <typename TFunc>
+	void parallelFor(size_t count, size_t grain, const TFunc& func);
+
+	//A loop that grows as it runs, for the work becoming ready only as the loop goes: `func(idx, spawn)` starts on
+	//[0, count) and may call `spawn(begin, end)` to add [begin, end), the loop returns once the added indices are done too.
+	//So a task hands over the work it has made ready instead of waiting for it. Needs resize to have been called.
+	template <typename TFunc>
+	void parallelForGrowing(size_t count, size_t grain, const TFunc& func);
+
+private:
+	struct Job
+	{
+		void (*run)(JobSystem& system, Job& job, size_t begin, size_t end);
+		const void* context;		// the loop body
+		size_t grain;
+		std::atomic_size_t remaining;
+	};
+
+	struct Task
+	{
+		Job* job;
+		size_t begin;
+		size_t end;
+	};
+
+	struct alignas(64) Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	//one per worker, the last one takes the tasks of the threads outside the pool
+	std::unique_ptr<Queue[]> m_queues;
+	size_t m_queuesCount{ 0 };
+	std::vector<std::thread> m_workers;
+
+	std::atomic_size_t m_queued{ 0 };		// tasks in all the queues, the idle workers sleep while it's zero
+	std::atomic_uint m_sleeping{ 0 };
+	bool m_stopping{ false };
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wakeUp;
+
+	void stop() noexcept;
+	void workerLoop(size_t queue) noexcept;
+	size_t currentQueue() const noexcept;
+	void push(size_t queue, const Task& task);
+	bool pop(size_t queue, Task& task) noexcept;
+	bool runOne(size_t queue);
+	void execute(size_t queue, Task task);
+	void runAndWait(Job& job, size_t count);
+	void spawn(Job& job, size_t begin, size_t end);
+};
+
+//Sorts on the calling thread. GCC's parallel mode (_GLIBCXX_PARALLEL) makes a big enough std::sort fork
+//an OpenMP team, which within a task only competes with the workers for the cores.
+template <typename TIterator, typename TCompare = std::less<>>
+void sequentialSort(TIterator first, TIterator last, TCompare compare = {})
+{
+#ifdef _GLIBCXX_PARALLEL
+	std::sort(first, last, compare, __gnu_parallel::sequential_tag());
+#else
+	std::sort(first, last, compare);
+#endif
+}
+
+template <typename TFunc>
+void JobSystem::parallelFor(size_t count, size_t grain, const TFunc& func)
+{
+	grain = std::max(grain, size_t(1));
+	if (count == 0)
+		return;
+
+	//not worth waking anyone up
+	if (m_workers.empty() || count <= grain)
+	{
+		for (size_t idx = 0; idx != count; ++idx)
+			func(idx);
+		return;
+	}
+
+	Job job
+	{
+		[](JobSystem&, Job& job, size_t begin, size_t end)
+		{
+			const auto& typedFunc = *static_cast<const TFunc*>(job.context);
+			for (auto idx = begin; idx != end; ++idx)
+				typedFunc(idx);
+		},
+		&func,
+		grain,
+		{ count }
+	};
+	runAndWait(job, count);
+}
+
+template <typename TFunc>
+void JobSystem::parallelForGrowing(size_t count, size_t grain, const TFunc& func)
+{
+	grain = std::max(grain, size_t(1));
+	if (count == 0)
+		return;
+
+	//no serial shortcut, the spawned indices go through the queues even without the workers
+	Job job
+	{
+		[](JobSystem& system, Job& job, size_t begin, size_t end)
+		{
+			const auto& typedFunc = *static_cast<const TFunc*>(job.context);
+			const auto spawn = [&](size_t spawnBegin, size_t spawnEnd) { system.spawn(job, spawnBegin, spawnEnd); };
+			for (auto idx = begin; idx != end; ++idx)
+				typedFunc(idx, spawn);
+		},
+		&func,
+		grain,
+		{ count }
+	};
+	runAndWait(job, count);
+}
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "glm-include.hpp"
+
+namespace rasterizer {
+
+//The projected triangles as indices into a shared vertex buffer. The buffer starts with the transformed mesh vertices,
+//followed by the ones the clipping creates, so an unclipped triangle costs three indices and every shared vertex
+//gets projected once. The vertex streams are separate, so the passes touching only the positions
+//(the viewport transform, the culling) don't drag the normals and texture coordinates through the cache.
+struct ProjectedTriangles
+{
+	std::vector<glm::vec4> positions;		// per vertex
+	std::vector<glm::vec3> normals;			// per vertex
+	std::vector<glm::vec2> texCoords0;		// per vertex
+	std::vector<glm::uvec3> indices;		// per triangle
+
+	size_t size() const noexcept;
+	void resizeVertices(size_t size);
+	std::array<glm::vec4, 3> trianglePositions(size_t idx) const noexcept;
+	void flipWinding(size_t idx) noexcept;
+};
+
+inline size_t ProjectedTriangles::size() const noexcept
+{
+	return indices.size();
+}
+
+inline void ProjectedTriangles::resizeVertices(size_t size)
+{
+	positions.resize(size);
+	normals.resize(size);
+	texCoords0.resize(size);
+}
+
+inline std::array<glm::vec4, 3> ProjectedTriangles::trianglePositions(size_t idx) const noexcept
+{
+	const auto& triangle = indices[idx];
+	return { positions[triangle.x], positions[triangle.y], positions[triangle.z] };
+}
+
+inline void ProjectedTriangles::flipWinding(size_t idx) noexcept
+{
+	std::swap(indices[idx].y, indices[idx].z);
+}
+
+}
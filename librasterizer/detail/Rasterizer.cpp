@@ -1,4 +1,11 @@
 #include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <new>
+#include <numeric>
+#include <optional>
+#include <thread>
 
 #include "basic-matrices.hpp"
 #include "clipping.hpp"
@@ -8,6 +15,22 @@
 
 namespace rasterizer {
 
+//The fewest indices a job system task runs for the loops over the vertices, triangles, coarse bins and pixels.
+//Enough work to outweigh the dispatch, yet small enough to leave the idle workers something to steal.
+static constexpr size_t kVerticesGrain = 1024;
+static constexpr size_t kTrianglesGrain = 256;
+static constexpr size_t kBinsGrain = 1;
+static constexpr size_t kPixelsGrain = 1024;
+//a column of the per-chunk bin counts each, the neighboring bins share the cache lines
+static constexpr size_t kBinColumnsGrain = 16;
+//the scans do next to nothing per index
+static constexpr size_t kScanGrain = 4096;
+
+Rasterizer::Rasterizer(const Options& options) noexcept
+{
+	setOptions(options);
+}
+
 void Rasterizer::setTexture(Texture texture) noexcept
 {
 	m_texture = std::move(texture);
@@ -16,24 +39,195 @@ void Rasterizer::setTexture(Texture texture) noexcept
 void Rasterizer::setMesh(Mesh mesh) noexcept
 {
 	m_mesh = std::move(mesh);
+	m_pipeline.vertexBlocks.clear();
+	restartAutotune();
+}
+
+void Rasterizer::setOptions(const Options& options) noexcept
+{
+	m_options = options;
+	restartAutotune();
+}
+
+const Rasterizer::Options& Rasterizer::options() const noexcept
+{
+	return m_options;
+}
+
+const Rasterizer::Statistics& Rasterizer::statistics() const noexcept
+{
+	return m_statistics;
 }
 
 void Rasterizer::draw(unsigned width, unsigned height, std::vector<gamma_bgra_t>& out)
 {
+	const auto start = std::chrono::steady_clock::now();
+
+	const auto hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	const auto workers = m_options.workerThreads.value_or(hardwareThreads - 1);
+	//the arena keeps chunks per thread, the ones of the workers about to exit would stay allocated for nothing
+	if (m_jobSystem.concurrency() != workers + 1)
+		m_frameArena.release();
+	m_jobSystem.resize(workers);
+
+	m_frameArena.reset();
 	resetViewport(width, height);
-	updateScene();
-	runPipleine();
-	swapBuffers(out);
+
+	const auto framesInFlight = std::clamp(m_options.framesInFlight, 1u, kMaxFramesInFlight);
+	if (m_frames.size() != framesInFlight)
+	{
+		dropFramesInFlight();
+		m_frames.resize(framesInFlight);
+		m_oldestFrame = 0;
+	}
+
+	//the first frames after a start, a resize or a change of the depth only fill the pipeline up
+	while (m_queuedFrames + 1 < m_frames.size())
+	{
+		runFrontEnd(m_frames[(m_oldestFrame + m_queuedFrames) % m_frames.size()]);
+		m_queuedFrames++;
+	}
+
+	if (m_frames.size() == 1)
+	{
+		runFrontEnd(m_frames.front());
+		runBackEnd(m_frames.front(), out);
+	}
+	else
+	{
+		//The front end touches only its own state and the frame it fills, the back end reads the frame the earlier calls filled.
+		//Both dispatch their loops into the job system, so their tasks share the workers.
+		auto& oldest = m_frames[m_oldestFrame];
+		auto& newest = m_frames[(m_oldestFrame + m_queuedFrames) % m_frames.size()];
+
+		m_jobSystem.parallelFor(2, 1, [&](size_t part)
+		{
+			if (part == 0)
+				runBackEnd(oldest, out);
+			else
+				runFrontEnd(newest);
+		});
+		m_oldestFrame = (m_oldestFrame + 1) % m_frames.size();
+	}
+
+	m_statistics.frameArenaBytes = m_frameArena.usedBytes();
+	m_statistics.frameArenaHighWaterMark = m_frameArena.highWaterMark();
+
+	if (m_autotune.running)
+		advanceAutotune(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+}
+
+void Rasterizer::restartAutotune() noexcept
+{
+	m_autotune = {};
+	m_autotune.running = m_options.autotuneTileSize;
+}
+
+void Rasterizer::advanceAutotune(double frameMilliseconds) noexcept
+{
+	if (m_autotune.frame != 0)
+		m_autotune.milliseconds[m_autotune.candidate] += frameMilliseconds;
+
+	if (++m_autotune.frame != Autotune::kFramesPerSize)
+		return;
+
+	m_autotune.frame = 0;
+	if (++m_autotune.candidate != kTileSizes.size())
+		return;
+
+	const auto best = std::min_element(m_autotune.milliseconds.cbegin(), m_autotune.milliseconds.cend()) - m_autotune.milliseconds.cbegin();
+	m_options.tileSize = unsigned(kTileSizes[best]);
+	m_autotune.running = false;
+}
+
+template <typename T, typename TValue, typename TWrite>
+T Rasterizer::parallelScan(size_t count, const TValue& value, const TWrite& write)
+{
+	//every chunk sums its values, a serial scan over the chunk sums gives their offsets, then every chunk writes its own
+	const auto chunks = (count + kScanGrain - 1) / kScanGrain;
+	if (chunks == 0)
+		return T(0);
+
+	const auto chunkOffsets = m_frameArena.allocate<T>(chunks);
+	m_jobSystem.parallelFor(chunks, 1, [&](size_t chunk)
+	{
+		auto sum = T(0);
+		for (auto idx = chunk * kScanGrain, end = std::min(idx + kScanGrain, count); idx != end; ++idx)
+			sum += value(idx);
+		chunkOffsets[chunk] = sum;
+	});
+
+	auto total = T(0);
+	for (size_t chunk = 0; chunk != chunks; ++chunk)
+	{
+		const auto sum = chunkOffsets[chunk];
+		chunkOffsets[chunk] = total;
+		total += sum;
+	}
+
+	m_jobSystem.parallelFor(chunks, 1, [&](size_t chunk)
+	{
+		auto offset = chunkOffsets[chunk];
+		for (auto idx = chunk * kScanGrain, end = std::min(idx + kScanGrain, count); idx != end; ++idx)
+		{
+			write(idx, offset);
+			offset += value(idx);
+		}
+	});
+
+	return total;
 }
 
 void Rasterizer::resetViewport(unsigned width, unsigned height)
 {
+	if (m_framebuffer.screenSize != glm::uvec2(width, height))
+	{
+		//the best tile size depends on the resolution as well
+		if (m_options.autotuneTileSize)
+			restartAutotune();
+
+		//the frames in flight were set up in the old screen coordinates
+		dropFramesInFlight();
+	}
+
 	m_framebuffer.screenSize = { width, height };
-	m_framebuffer.gridDim = Tile::computeGridDim(m_framebuffer.screenSize);
-	m_framebuffer.grid.resize(size_t(m_framebuffer.gridDim.x) * size_t(m_framebuffer.gridDim.y));
+
+	const auto requestedTileSize = m_autotune.running ? kTileSizes[m_autotune.candidate] : m_options.tileSize;
+	const auto supported = std::find(kTileSizes.cbegin(), kTileSizes.cend(), requestedTileSize) != kTileSizes.cend();
+	//the fallback must have a kernel too, or rasterizationStage would skip every tile
+	static_assert(TILE_SIZE == kTileSizes[0] || TILE_SIZE == kTileSizes[1] || TILE_SIZE == kTileSizes[2], "TILE_SIZE must be one of kTileSizes");
+	m_framebuffer.tileSize = supported ? unsigned(requestedTileSize) : unsigned(TILE_SIZE);
+	m_framebuffer.gridDim = (m_framebuffer.screenSize - glm::uvec2(1)) / glm::uvec2(m_framebuffer.tileSize) + glm::uvec2(1);
+
+	//a resize reuses the grid-wide buffers, there's nothing to construct per tile
+	const auto tilePixels = size_t(m_framebuffer.gridDim.x) * size_t(m_framebuffer.gridDim.y) * m_framebuffer.tileSize * m_framebuffer.tileSize;
+	m_framebuffer.color.resize(tilePixels);
+	m_framebuffer.normal.resize(tilePixels);
+	m_framebuffer.depth.resize(tilePixels);
+	m_statistics.tileSize = m_framebuffer.tileSize;
+
+	m_framebuffer.coarseGridDim = CoarseBin::computeGridDim(m_framebuffer.screenSize);
+	m_framebuffer.coarseGrid.resize(size_t(m_framebuffer.coarseGridDim.x) * size_t(m_framebuffer.coarseGridDim.y));
 
 	m_pipeline.matrices.viewport = matrices::viewportTransformMatrix(float(width), float(height));
 	m_pipeline.matrices.projection = matrices::projectionMatrix(float(width), float(height), m_parameters.verticalFovDeg, m_parameters.zNear, m_parameters.zFar);
+
+	//The guard band keeps the screen coordinates within the range where floats are still precise to a fraction
+	//of a subpixel, so the setup and the fixed-point snapping don't degrade for huge triangles.
+	constexpr float kGuardBandPixels = 16384.0f;
+	const auto guardBand = m_options.guardBandClipping ?
+		glm::max(glm::vec2(kGuardBandPixels) / (glm::vec2(m_framebuffer.screenSize) * 0.5f), glm::vec2(1.0f)) :
+		glm::vec2(1.0f);
+
+	m_pipeline.clippingPlanes =
+	{
+		glm::vec4{0.0f, 0.0f, 1.0f, 0.0f},				// near
+		glm::vec4{0.0f, 0.0f, -1.0f, 1.0f},				// far
+		glm::vec4{-1.0f, 0.0f, 0.0f, guardBand.x},		// right
+		glm::vec4{1.0f, 0.0f, 0.0f, guardBand.x},		// left
+		glm::vec4{0.0f, -1.0f, 0.0f, guardBand.y},		// top
+		glm::vec4{0.0f, 1.0f, 0.0f, guardBand.y}		// bottom
+	};
 }
 
 void Rasterizer::updateScene()
@@ -47,173 +241,768 @@ void Rasterizer::updateScene()
 	frameIdx++;*/
 
 	m_pipeline.matrices.modelView = matrices::viewMatrix(m_parameters.rotateDeg, m_parameters.translate) * glm::scale(glm::identity<glm::mat4>(), m_parameters.scale);
-	m_pipeline.matrices.normal = glm::transpose(glm::inverse(m_pipeline.matrices.modelView));
+	m_pipeline.matrices.normal = glm::mat3(glm::transpose(glm::inverse(m_pipeline.matrices.modelView)));
 }
 
-void Rasterizer::runPipleine()
+void Rasterizer::dropFramesInFlight() noexcept
 {
+	//the scene goes back to where the oldest dropped frame started, so filling the pipeline up again redoes them
+	if (m_queuedFrames != 0)
+		m_parameters = m_frames[m_oldestFrame].scene;
+	m_queuedFrames = 0;
+}
+
+void Rasterizer::runFrontEnd(Frame& frame)
+{
+	frame.scene = m_parameters;
+	updateScene();
 	vertexStage();
 	clippingStage();
 	viewportTransformStage();
-	rasterizationStage();
-	postProcessingStage();
+	cullingStage(frame);
+	triangleSetupStage(frame);
+	frame.matrices = m_pipeline.matrices;
+}
+
+void Rasterizer::runBackEnd(const Frame& frame, std::vector<gamma_bgra_t>& out)
+{
+	//the post-processing runs per coarse bin within the rasterization, see rasterizeBins
+	rasterizationStage(frame);
+	swapBuffers(out);
+
+	m_statistics.culledByFacing = frame.culledByFacing;
+	m_statistics.culledDegenerate = frame.culledDegenerate;
+	m_statistics.culledMissingSamples = frame.culledMissingSamples;
 }
 
 void Rasterizer::vertexStage()
 {
 	const auto& positions = m_mesh.positions();
 	const auto& normals = m_mesh.normals();
+	const auto& texCoords0 = m_mesh.texCoords0();
 
-	auto& positionsOut = m_pipeline.vertexStageOutput.positions;
-	auto& normalsOut = m_pipeline.vertexStageOutput.normals;
+	//the mesh vertices open the vertex buffer, the clipping appends its own ones after them
+	auto& vertices = m_pipeline.projectedTriangles;
+	auto& outcodesOut = m_pipeline.outcodes;
 
-	positionsOut.resize(positions.size());
-	normalsOut.resize(normals.size());
+	vertices.resizeVertices(positions.size());
+	outcodesOut.resize(positions.size());
+
+	if (m_pipeline.vertexBlocks.empty())
+		VertexBlock::gather(positions, normals, m_pipeline.vertexBlocks);
 
 	const auto modelViewProjectionMat = m_pipeline.matrices.projection * m_pipeline.matrices.modelView;
+	const auto& blocks = m_pipeline.vertexBlocks;
 
-	std::transform(TRY_PARALLELIZE_PAR_UNSEQ positions.cbegin(), positions.cend(), positionsOut.begin(), [&](const glm::vec3& in)
+	//the outcodes come along with the transform while the position is still in registers
+	m_jobSystem.parallelFor(blocks.size(), kVerticesGrain / VertexBlock::kSize, [&](size_t blockIdx)
 	{
-		return modelViewProjectionMat * glm::vec4(in, 1.0f);
-	});
+		const auto first = blockIdx * VertexBlock::kSize;
+		const auto count = std::min(VertexBlock::kSize, positions.size() - first);
 
-	std::transform(TRY_PARALLELIZE_PAR_UNSEQ normals.cbegin(), normals.cend(), normalsOut.begin(), [&](const glm::vec3& in) -> glm::vec3
-	{
-		return m_pipeline.matrices.normal * glm::vec4(in, 0.0f);
+		blocks[blockIdx].transform(
+			count,
+			modelViewProjectionMat,
+			m_pipeline.matrices.normal,
+			m_pipeline.clippingPlanes,
+			vertices.positions.data() + first,
+			vertices.normals.data() + first,
+			outcodesOut.data() + first);
+
+		std::copy_n(texCoords0.cbegin() + first, count, vertices.texCoords0.begin() + first);
 	});
 }
 
 void Rasterizer::clippingStage()
 {
-	typedef std::array<glm::vec4, 6> clipping_planes_storage_t;
-	//homogeneous planes in the clipping space
-	constexpr clipping_planes_storage_t clippingPlanes
-	{
-		glm::vec4{0.0f, 0.0f, 1.0f, 0.0f},	// near
-		glm::vec4{0.0f, 0.0f, -1.0f, 1.0f},	// far
-		glm::vec4{-1.0f, 0.0f, 0.0f, 1.0f},	// right
-		glm::vec4{1.0f, 0.0f, 0.0f, 1.0f},	// left
-		glm::vec4{0.0f, -1.0f, 0.0f, 1.0f},	// top
-		glm::vec4{0.0f, 1.0f, 0.0f, 1.0f}	// bottom
+	const auto& triangles = m_mesh.triangles();
+	const auto& outcodes = m_pipeline.outcodes;
+	const auto meshVertices = uint32_t(m_mesh.positions().size());
+	auto& clipping = m_pipeline.clipping;
+	auto& projected = m_pipeline.projectedTriangles;
+
+	const auto crossedPlanes = [&](const glm::u16vec3& trIn)
+	{
+		return clipping::outcode_t(outcodes[trIn.x] | outcodes[trIn.y] | outcodes[trIn.z]);
 	};
 
+	const auto clip = [&](const glm::u16vec3& trIn, clipping::Polygon& polygon)
+	{
+		const std::array<glm::vec4, 3> positions{ projected.positions[trIn.x], projected.positions[trIn.y], projected.positions[trIn.z] };
+		return clipping::clipTriangle(positions, m_pipeline.clippingPlanes, crossedPlanes(trIn), polygon);
+	};
 
-	std::atomic_bool lock{ false };
-	m_pipeline.projectedTriangles.clear();
+	//Each mesh triangle is clipped on its own, so there is no shared output to contend for.
+	//An unclipped triangle keeps indexing the mesh vertices, only the vertices the clipping creates are new.
+	//The outputs are compacted in the mesh order through a prefix sum over the numbers of triangles and new vertices,
+	//which keeps the projected triangles deterministic. Clipping is rare, so a clipped triangle is clipped once more
+	//while compacting rather than keeping its polygon between the passes.
+	clipping.counts.resize(triangles.size() + 1);
+	clipping.offsets.resize(triangles.size() + 1);
+	clipping.counts.back() = glm::uvec2(0);
 
-	std::for_each(TRY_PARALLELIZE_PAR_UNSEQ m_mesh.triangles().cbegin(), m_mesh.triangles().cend(), [&](const glm::u16vec3& trIn)
+	const auto countOutputs = [&](const glm::u16vec3& trIn) -> glm::uvec2
 	{
-		constexpr std::array<glm::vec2, 3> rootTriangle{ glm::vec2{1.0f, 0.0f}, glm::vec2{0.0f, 1.0f}, glm::vec2{0.0f, 0.0f} };
+		//trivial reject: all the vertices lie behind the same plane
+		if (outcodes[trIn.x] & outcodes[trIn.y] & outcodes[trIn.z])
+			return glm::uvec2(0);
 
-		clipping::RecursiveClipper<clipping_planes_storage_t> clipper
+		//trivial accept: all the vertices lie inside, which is the case for the vast majority of triangles
+		if (crossedPlanes(trIn) == 0)
+			return glm::uvec2(1, 0);
+
+		clipping::Polygon polygon;
+		if (!clip(trIn, polygon))
+			return glm::uvec2(0);
+
+		uint32_t newVertices = 0;
+		for (size_t i = 0; i != polygon.count; ++i)
+			newVertices += polygon.cornerOf(i) < 0;
+
+		return glm::uvec2(polygon.count - 2, newVertices);
+	};
+
+	m_jobSystem.parallelFor(triangles.size(), kTrianglesGrain, [&](size_t idx)
+	{
+		clipping.counts[idx] = countOutputs(triangles[idx]);
+	});
+
+	parallelScan<glm::uvec2>(clipping.counts.size(),
+		[&](size_t idx) { return clipping.counts[idx]; },
+		[&](size_t idx, const glm::uvec2& offset) { clipping.offsets[idx] = offset; });
+
+	projected.indices.resize(clipping.offsets.back().x);
+	projected.resizeVertices(meshVertices + clipping.offsets.back().y);
+
+	m_jobSystem.parallelFor(triangles.size(), kTrianglesGrain, [&](size_t idx)
+	{
+		const auto& trIn = triangles[idx];
+		const auto out = clipping.offsets[idx];
+		const auto corners = glm::uvec3(trIn);
+
+		if (clipping.counts[idx].x == 0)
+			return;
+
+		if (crossedPlanes(trIn) == 0)
+		{
+			projected.indices[out.x] = corners;
+			return;
+		}
+
+		clipping::Polygon polygon;
+		clip(trIn, polygon);
+
+		//the attributes are interpolated once per polygon vertex, the original corners are shared as is
+		std::array<uint32_t, clipping::Polygon::kMaxVertices> polygonIndices;
+		auto newVertex = meshVertices + out.y;
+		for (size_t i = 0; i != polygon.count; ++i)
 		{
+			const auto corner = polygon.cornerOf(i);
+			if (corner >= 0)
 			{
-				Vertex{m_pipeline.vertexStageOutput.positions[trIn.x], m_pipeline.vertexStageOutput.normals[trIn.x], m_mesh.texCoords0()[trIn.x]},
-				Vertex{m_pipeline.vertexStageOutput.positions[trIn.y], m_pipeline.vertexStageOutput.normals[trIn.y], m_mesh.texCoords0()[trIn.y]},
-				Vertex{m_pipeline.vertexStageOutput.positions[trIn.z], m_pipeline.vertexStageOutput.normals[trIn.z], m_mesh.texCoords0()[trIn.z]}
-			},
-			clippingPlanes.begin(),
-			clippingPlanes.end(),
-
-			lock,
-			m_pipeline.projectedTriangles
-		};
-
-		clipper(rootTriangle);
+				polygonIndices[i] = corners[corner];
+				continue;
+			}
+
+			const auto& barycentric = polygon.vertices[i];
+			projected.positions[newVertex] = clipping::interpolate(std::array<glm::vec4, 3>{ projected.positions[trIn.x], projected.positions[trIn.y], projected.positions[trIn.z] }, barycentric);
+			projected.normals[newVertex] = clipping::interpolate(std::array<glm::vec3, 3>{ projected.normals[trIn.x], projected.normals[trIn.y], projected.normals[trIn.z] }, barycentric);
+			projected.texCoords0[newVertex] = clipping::interpolate(std::array<glm::vec2, 3>{ projected.texCoords0[trIn.x], projected.texCoords0[trIn.y], projected.texCoords0[trIn.z] }, barycentric);
+			polygonIndices[i] = newVertex++;
+		}
+
+		for (size_t i = 2; i < polygon.count; ++i)
+			projected.indices[out.x + i - 2] = { polygonIndices[0], polygonIndices[i - 1], polygonIndices[i] };
 	});
 }
 
 void Rasterizer::viewportTransformStage()
 {
-	std::for_each(TRY_PARALLELIZE_PAR_UNSEQ m_pipeline.projectedTriangles.begin(), m_pipeline.projectedTriangles.end(), [&](std::array<Vertex, 3>& triangle)
+	//once per vertex rather than once per triangle corner, the shared vertices are projected only once
+	auto& positions = m_pipeline.projectedTriangles.positions;
+	m_jobSystem.parallelFor(positions.size(), kVerticesGrain, [&](size_t idx)
+	{
+		auto& position = positions[idx];
+		position = m_pipeline.matrices.viewport * position;
+		//IMPORTANT: We must save the original Z value for further perspective-correct interpolation
+		//Instead of getting (x,y,z,1) we store (x,y,z,originalZ)
+		position = { position.xyz() / position.w, position.w };
+	});
+}
+
+namespace {
+
+enum CullResult : uint8_t
+{
+	kVisible,
+	kCulledByFacing,
+	kCulledDegenerate,
+	kCulledMissingSamples
+};
+
+}
+
+void Rasterizer::cullingStage(Frame& frame)
+{
+	auto& triangles = m_pipeline.projectedTriangles;
+	auto& culling = m_pipeline.culling;
+	const auto cullMode = m_options.cullMode;
+	const auto fixedPoint = m_options.fixedPointRasterization;
+
+	culling.results.resize(triangles.size());
+
+	//only the positions are needed to decide
+	m_jobSystem.parallelFor(triangles.size(), kTrianglesGrain, [&](size_t idx)
 	{
-		for (Vertex& v : triangle)
+		const auto footprint = TriangleEdges::footprint(triangles.trianglePositions(idx), fixedPoint);
+		auto& result = culling.results[idx];
+
+		//the area is computed in the same precision the rasterization uses, so a kept triangle always has a non-zero one
+		if (footprint.area == 0.0f || !std::isfinite(footprint.area))
+			result = kCulledDegenerate;
+		else if ((cullMode == CullMode::back && footprint.area < 0.0f) || (cullMode == CullMode::front && footprint.area > 0.0f))
+			result = kCulledByFacing;
+		else if (footprint.missesSamples())
+			result = kCulledMissingSamples;
+		else
+			result = kVisible;
+
+		//the tiles rasterize only the front side, so the kept back-facing triangles get flipped
+		if (result == kVisible && footprint.area < 0.0f)
+			triangles.flipWinding(idx);
+	});
+
+	//the compaction keeps the order, so the binning stays deterministic, and the same pass counts the culled triangles
+	culling.offsets.resize(triangles.size());
+	const auto counts = parallelScan<glm::uvec4>(culling.results.size(),
+		[&](size_t idx)
 		{
-			v.position = m_pipeline.matrices.viewport * v.position;
-			//IMPORTANT: We must save the original Z value for further perspective-correct interpolation
-			//Instead of getting (x,y,z,1) we store (x,y,z,originalZ)
-			v.position = { v.position.xyz() / v.position.w, v.position.w };
-		}
+			const auto result = culling.results[idx];
+			return glm::uvec4(result == kVisible, result == kCulledByFacing, result == kCulledDegenerate, result == kCulledMissingSamples);
+		},
+		[&](size_t idx, const glm::uvec4& offset) { culling.offsets[idx] = offset.x; });
+
+	frame.culledByFacing = size_t(counts.y);
+	frame.culledDegenerate = size_t(counts.z);
+	frame.culledMissingSamples = size_t(counts.w);
+
+	culling.visibleTriangles.resize(counts.x);
+	m_jobSystem.parallelFor(culling.results.size(), kTrianglesGrain, [&](size_t idx)
+	{
+		if (culling.results[idx] == kVisible)
+			culling.visibleTriangles[culling.offsets[idx]] = triangles.indices[idx];
+	});
+
+	std::swap(triangles.indices, culling.visibleTriangles);
+}
+
+void Rasterizer::triangleSetupStage(Frame& frame)
+{
+	const auto& triangles = m_pipeline.projectedTriangles;
+	frame.triangleSetups.resize(triangles.size());
+
+	m_jobSystem.parallelFor(triangles.size(), kTrianglesGrain, [&](size_t idx)
+	{
+		frame.triangleSetups.setup(idx, triangles, idx, m_options.fixedPointRasterization);
 	});
 }
 
-void Rasterizer::rasterizationStage()
+//interleaves the bits of the coordinates, y takes the odd ones
+static uint32_t mortonEncode(glm::uvec2 cell) noexcept
+{
+	uint32_t result = 0;
+	for (uint32_t bit = 0; bit != 16; ++bit)
+		result |= ((cell.x >> bit) & 1) << (2 * bit) | ((cell.y >> bit) & 1) << (2 * bit + 1);
+	return result;
+}
+
+static glm::uvec2 mortonDecode(uint32_t code) noexcept
+{
+	glm::uvec2 result(0);
+	for (uint32_t bit = 0; bit != 16; ++bit)
+	{
+		result.x |= ((code >> (2 * bit)) & 1) << bit;
+		result.y |= ((code >> (2 * bit + 1)) & 1) << bit;
+	}
+	return result;
+}
+
+//the range of pixels a triangle may cover, it's empty if any component of the minimum exceeds the maximum
+static std::pair<glm::uvec2, glm::uvec2> pixelBounds(const TriangleEdges& setup, glm::uvec2 screenSize) noexcept
 {
-	std::for_each(TRY_PARALLELIZE_PAR_UNSEQ m_pipeline.projectedTriangles.cbegin(), m_pipeline.projectedTriangles.cend(), [&](const std::array<Vertex, 3>& triangle)
+	//with the guard band clipping a triangle may stick out of the screen or even lie entirely outside it
+	const auto minPixel = glm::max(setup.minPixel, glm::ivec2(0));
+	const auto maxPixel = glm::min(setup.maxPixel, glm::ivec2(screenSize - glm::uvec2(1)));
+
+	if (minPixel.x > maxPixel.x || minPixel.y > maxPixel.y)
+		return { glm::uvec2(1), glm::uvec2(0) };
+
+	return { glm::uvec2(minPixel), glm::uvec2(maxPixel) };
+}
+
+//the range of coarse bins a triangle may touch, it's empty if any component of the minimum exceeds the maximum
+static std::pair<glm::uvec2, glm::uvec2> binBounds(const TriangleEdges& setup, glm::uvec2 screenSize) noexcept
+{
+	const auto [minPixel, maxPixel] = pixelBounds(setup, screenSize);
+	if (minPixel.x > maxPixel.x || minPixel.y > maxPixel.y)
+		return { glm::uvec2(1), glm::uvec2(0) };
+
+	return { minPixel / glm::uvec2(CoarseBin::kSize), maxPixel / glm::uvec2(CoarseBin::kSize) };
+}
+
+//Calls `func(xCell, yCell)` for each cell of a grid the triangle overlaps. The bounding box gives the candidates,
+//the edge functions reject the cells the triangle doesn't actually touch (long diagonal slivers have plenty of them).
+//Returns the number of rejected cells.
+template <typename TFunc>
+static size_t forEachOverlappedCell(const TriangleEdges& setup, glm::uvec2 minCell, glm::uvec2 maxCell, unsigned cellSize, glm::uvec2 screenSize, TFunc&& func)
+{
+	//a small triangle usually falls into a single cell, which it overlaps unless it covers no pixel at all
+	if (minCell == maxCell)
+	{
+		func(minCell.x, minCell.y);
+		return 0;
+	}
+
+	size_t rejected = 0;
+	for (unsigned yCell = minCell.y; yCell <= maxCell.y; ++yCell)
 	{
-		const auto triangleBox = BoundingBox2D{ triangle[0].position.xy(), triangle[1].position.xy(), triangle[2].position.xy() };
-		const auto minPixel = glm::uvec2(glm::ceil(triangleBox.min()));
-		const auto maxPixel = glm::min(glm::uvec2(glm::ceil(triangleBox.max())), m_framebuffer.screenSize - glm::uvec2(1));
+		for (unsigned xCell = minCell.x; xCell <= maxCell.x; ++xCell)
+		{
+			const auto minPixel = glm::uvec2(xCell, yCell) * cellSize;
+			const auto maxPixel = glm::min(minPixel + glm::uvec2(cellSize - 1), screenSize - glm::uvec2(1));
 
-		const auto minTile = minPixel / glm::uvec2(Tile::kSize);
-		const auto maxTile = maxPixel / glm::uvec2(Tile::kSize);
+			if (setup.overlaps(glm::ivec2(minPixel), glm::ivec2(maxPixel)))
+				func(xCell, yCell);
+			else
+				rejected++;
+		}
+	}
+	return rejected;
+}
 
-		for (unsigned yTile = minTile.y; yTile <= maxTile.y; ++yTile)
+void Rasterizer::rasterizationStage(const Frame& frame)
+{
+	//the binning needs only the edges
+	const auto& setups = frame.triangleSetups.edges;
+	auto& binning = m_pipeline.binning;
+	auto& coarseGrid = m_framebuffer.coarseGrid;
+	const auto screenSize = m_framebuffer.screenSize;
+
+	std::atomic_size_t coarseRejected{ 0 };
+
+	//Coarse binning without locks: every chunk of triangles counts its entries per bin, and a scan over the chunks gives
+	//each of them its place within every bin, so the bins get their ranges of the shared buffer up front and come out
+	//in the mesh order. The entries themselves are written while the complete bins already rasterize, see rasterizeBins.
+	const auto binsCount = coarseGrid.size();
+	const auto trianglesChunks = (setups.size() + kTrianglesGrain - 1) / kTrianglesGrain;
+	binning.chunkCounts = m_frameArena.allocate<uint32_t>(trianglesChunks * binsCount);
+	binning.chunkOffsets = m_frameArena.allocate<uint32_t>(trianglesChunks * binsCount);
+	binning.progress = m_frameArena.allocate<CoarseBin::Progress>(binsCount);
+
+	m_jobSystem.parallelFor(trianglesChunks, 1, [&](size_t chunk)
+	{
+		const auto counts = binning.chunkCounts + chunk * binsCount;
+		std::fill_n(counts, binsCount, 0u);
+
+		size_t rejected = 0;
+		const auto end = std::min((chunk + 1) * kTrianglesGrain, setups.size());
+		for (auto triangleIdx = chunk * kTrianglesGrain; triangleIdx != end; ++triangleIdx)
 		{
-			const auto stride = m_framebuffer.gridDim.x * yTile;
-			for (unsigned xTile = minTile.x; xTile <= maxTile.x; ++xTile)
+			const auto& setup = setups[triangleIdx];
+			const auto [minBin, maxBin] = binBounds(setup, screenSize);
+
+			rejected += forEachOverlappedCell(setup, minBin, maxBin, CoarseBin::kSize, screenSize, [&](unsigned xBin, unsigned yBin)
 			{
-				const auto idx = stride + xTile;
-				m_framebuffer.grid[idx].scheduleTriangle(triangle);
-			}
+				counts[size_t(m_framebuffer.coarseGridDim.x) * yBin + xBin]++;
+			});
 		}
+		if (rejected)
+			coarseRejected.fetch_add(rejected, std::memory_order_relaxed);
 	});
 
-	const auto totalPixels = size_t(m_framebuffer.screenSize.x) * size_t(m_framebuffer.screenSize.y);
+	//a bin scans its column of the chunks' counts
+	m_jobSystem.parallelFor(binsCount, kBinColumnsGrain, [&](size_t binIdx)
+	{
+		uint32_t entries = 0;
+		for (size_t chunk = 0; chunk != trianglesChunks; ++chunk)
+		{
+			binning.chunkOffsets[chunk * binsCount + binIdx] = entries;
+			entries += binning.chunkCounts[chunk * binsCount + binIdx];
+		}
+		new (binning.progress + binIdx) CoarseBin::Progress{ entries };
+	});
+
+	//the bins are few, a serial scan does
+	size_t entriesCount = 0;
+	for (size_t binIdx = 0; binIdx != binsCount; ++binIdx)
+	{
+		coarseGrid[binIdx].firstEntry = entriesCount;
+		entriesCount += binning.progress[binIdx].entries;
+		coarseGrid[binIdx].lastEntry = entriesCount;
+	}
+	binning.entries.resize(entriesCount);
+
+	const auto totalPixels = size_t(screenSize.x) * size_t(screenSize.y);
 	m_postProcessing.color.resize(totalPixels);
 	m_postProcessing.normal.resize(totalPixels);
 	m_postProcessing.depth.resize(totalPixels);
+	m_postProcessing.lit.resize(totalPixels);
+	m_postProcessing.output.resize(totalPixels);
+
+	switch (m_framebuffer.tileSize)
+	{
+	case kTileSizes[0]: rasterizeBins<Tile<kTileSizes[0]>>(frame); break;
+	case kTileSizes[1]: rasterizeBins<Tile<kTileSizes[1]>>(frame); break;
+	case kTileSizes[2]: rasterizeBins<Tile<kTileSizes[2]>>(frame); break;
+	}
+
+	m_statistics.coarseBinEntries = entriesCount;
+	m_statistics.coarseBinEntriesRejected = coarseRejected.load();
+}
+
+template <typename TTile>
+void Rasterizer::rasterizeBins(const Frame& frame)
+{
+	static_assert(CoarseBin::kSize % TTile::kSize == 0, "a coarse bin must consist of whole tiles");
+	constexpr auto kBinTiles = CoarseBin::kTiles<TTile>;
+
+	const auto& setups = frame.triangleSetups.edges;
+	auto& binning = m_pipeline.binning;
+	const auto& coarseGrid = m_framebuffer.coarseGrid;
+	const auto screenSize = m_framebuffer.screenSize;
+	const auto gridDim = m_framebuffer.gridDim;
+
+	const auto binTiles = [&](const CoarseBin& bin)
+	{
+		const auto binIdx = &bin - coarseGrid.data();
+		const auto [yBin, xBin] = std::div(binIdx, m_framebuffer.coarseGridDim.x);
+
+		const auto binMinTile = glm::uvec2(xBin, yBin) * glm::uvec2(kBinTiles);
+		const auto binMaxTile = glm::min(binMinTile + glm::uvec2(kBinTiles), gridDim) - glm::uvec2(1);
+		return std::make_pair(binMinTile, binMaxTile);
+	};
+
+	//calls `func(xTile, yTile, triangleIdx)` for every tile of the bin every triangle of the bin overlaps, returns the number of rejected tiles
+	const auto forEachTileEntry = [&](const CoarseBin& bin, auto&& func)
+	{
+		const auto [binMinTile, binMaxTile] = binTiles(bin);
+		size_t rejected = 0;
+
+		for (auto entryIdx = bin.firstEntry; entryIdx != bin.lastEntry; ++entryIdx)
+		{
+			const auto triangleIdx = binning.entries[entryIdx];
+			const auto& setup = setups[triangleIdx];
+			const auto [minPixel, maxPixel] = pixelBounds(setup, screenSize);
+
+			const auto minTile = glm::max(minPixel / glm::uvec2(TTile::kSize), binMinTile);
+			const auto maxTile = glm::min(maxPixel / glm::uvec2(TTile::kSize), binMaxTile);
+
+			rejected += forEachOverlappedCell(setup, minTile, maxTile, TTile::kSize, screenSize, [&](unsigned xTile, unsigned yTile)
+			{
+				func(xTile, yTile, triangleIdx);
+			});
+		}
+		return rejected;
+	};
+
+	//in the Morton order, so the neighboring tiles sharing triangles are rasterized back to back
+	const auto forEachBinTile = [&](const CoarseBin& bin, auto&& func)
+	{
+		const auto [binMinTile, binMaxTile] = binTiles(bin);
+		for (uint32_t code = 0; code != kBinTiles * kBinTiles; ++code)
+		{
+			const auto tile = binMinTile + mortonDecode(code);
+			if (tile.x <= binMaxTile.x && tile.y <= binMaxTile.y)
+				func(tile.x, tile.y);
+		}
+	};
+
+	std::atomic_size_t tileEntries{ 0 };
+	std::atomic_size_t tileRejected{ 0 };
+	std::atomic_size_t tileCovering{ 0 };
+	std::atomic_size_t tileDiscarded{ 0 };
+	std::atomic_size_t tileOccluded{ 0 };
+	std::atomic_size_t shadedFragments{ 0 };
+
+	const auto tilesCount = size_t(gridDim.x) * size_t(gridDim.y);
+	binning.tileCounts.resize(tilesCount);
+	binning.tileOffsets.resize(tilesCount);
+
+	//The frame time is set by the slowest worker, and the bins range from the empty background to the silhouettes with
+	//hundreds of triangles. So the bins are handed out the heaviest first: whatever a worker picks up last is cheap.
+	//The bins of the same cost (the background mostly) follow the Morton order to stay close to each other.
+	//The estimated cost: a tile costs about as much as a triangle to clear and resolve, a triangle costs a tile each.
+	//Only the coarse entries are known before the bin gets rasterized, so they stand in for the tile entries.
+	binning.binCosts.resize(coarseGrid.size());
+	for (const auto& bin : coarseGrid)
+	{
+		const auto [binMinTile, binMaxTile] = binTiles(bin);
+		const auto binTilesCount = size_t(binMaxTile.x - binMinTile.x + 1) * size_t(binMaxTile.y - binMinTile.y + 1);
+		binning.binCosts[&bin - coarseGrid.data()] = bin.lastEntry - bin.firstEntry + binTilesCount;
+	}
+
+	binning.schedule.resize(coarseGrid.size());
+	std::iota(binning.schedule.begin(), binning.schedule.end(), uint32_t(0));
+	sequentialSort(binning.schedule.begin(), binning.schedule.end(), [&](uint32_t lhs, uint32_t rhs)
+	{
+		if (binning.binCosts[lhs] != binning.binCosts[rhs])
+			return binning.binCosts[lhs] > binning.binCosts[rhs];
 
-	std::for_each(TRY_PARALLELIZE_PAR_UNSEQ m_framebuffer.grid.begin(), m_framebuffer.grid.end(), [&](Tile& tile)
+		const auto coarseGridWidth = m_framebuffer.coarseGridDim.x;
+		return mortonEncode({ lhs % coarseGridWidth, lhs / coarseGridWidth }) < mortonEncode({ rhs % coarseGridWidth, rhs / coarseGridWidth });
+	});
+
+	//A chunk writes its entries at its own places within the bins, then publishes them to every bin it has any in
+	//at once. The chunk publishing a bin's last entries completes it and calls `complete(binIdx)`.
+	const auto binsCount = coarseGrid.size();
+	const auto writeEntries = [&](size_t chunk, auto&& complete)
 	{
-		const auto idx = std::distance(m_framebuffer.grid.data(), &tile);
-		const auto [yTile, xTile] = std::div(idx, m_framebuffer.gridDim.x);
+		const auto counts = binning.chunkCounts + chunk * binsCount;
+		const auto cursors = binning.chunkOffsets + chunk * binsCount;
 
-		const auto tileMin = glm::vec2(xTile, yTile) * glm::vec2(Tile::kSize);
-		const auto tileMax = tileMin + glm::vec2(Tile::kSize);
+		const auto end = std::min((chunk + 1) * kTrianglesGrain, setups.size());
+		for (auto triangleIdx = chunk * kTrianglesGrain; triangleIdx != end; ++triangleIdx)
+		{
+			const auto& setup = setups[triangleIdx];
+			const auto [minBin, maxBin] = binBounds(setup, screenSize);
+
+			forEachOverlappedCell(setup, minBin, maxBin, CoarseBin::kSize, screenSize, [&](unsigned xBin, unsigned yBin)
+			{
+				const auto binIdx = size_t(m_framebuffer.coarseGridDim.x) * yBin + xBin;
+				binning.entries[coarseGrid[binIdx].firstEntry + cursors[binIdx]++] = uint32_t(triangleIdx);
+			});
+		}
+
+		for (size_t binIdx = 0; binIdx != binsCount; ++binIdx)
+		{
+			auto& progress = binning.progress[binIdx];
+			if (counts[binIdx] != 0 && progress.written.fetch_add(counts[binIdx], std::memory_order_release) + counts[binIdx] == progress.entries)
+				complete(binIdx);
+		}
+	};
+
+	//The fine binning is the same count, scan and write sequence as the coarse one, but it's local to the bin,
+	//so a bin doesn't wait for any other one. Its tiles' entries are a single buffer from the frame arena.
+	//The worker rasterizes the tiles right away, while the triangles are still in the cache.
+	const auto rasterizeBin = [&](const CoarseBin& bin)
+	{
+		forEachBinTile(bin, [&](unsigned xTile, unsigned yTile)
+		{
+			binning.tileCounts[size_t(gridDim.x) * yTile + xTile] = 0;
+		});
+
+		uint32_t binEntries = 0;
+		const auto rejected = forEachTileEntry(bin, [&](unsigned xTile, unsigned yTile, uint32_t)
+		{
+			binning.tileCounts[size_t(gridDim.x) * yTile + xTile]++;
+			binEntries++;
+		});
+
+		//the counts turn into the write cursors, they end up the numbers of the kept entries
+		uint32_t offset = 0;
+		forEachBinTile(bin, [&](unsigned xTile, unsigned yTile)
+		{
+			const auto tileIdx = size_t(gridDim.x) * yTile + xTile;
+			binning.tileOffsets[tileIdx] = offset;
+			offset += binning.tileCounts[tileIdx];
+			binning.tileCounts[tileIdx] = 0;
+		});
+		const auto binTileEntries = m_frameArena.allocate<uint32_t>(binEntries);
 
-		const auto tileBox = BoundingBox2D{ tileMin, tileMax };
+		//per tile of the bin, the nearest depth among the entries kept so far
+		std::array<float, kBinTiles * kBinTiles> keptMinDepth;
+		keptMinDepth.fill(std::numeric_limits<float>::infinity());
 
-		tile.rasterize(tileBox, { m_texture });
+		const auto binMinTile = binTiles(bin).first;
+		size_t binCovering = 0;
+		size_t binDiscarded = 0;
 
-		for (size_t yPixel = 0; yPixel < Tile::kSize; ++yPixel)
+		forEachTileEntry(bin, [&](unsigned xTile, unsigned yTile, uint32_t triangleIdx)
 		{
-			for (size_t xPixel = 0; xPixel < Tile::kSize; ++xPixel)
+			const auto tileIdx = size_t(gridDim.x) * yTile + xTile;
+			const auto tileMin = glm::ivec2(xTile, yTile) * int(TTile::kSize);
+			const auto coversTile = setups[triangleIdx].covers(tileMin, tileMin + glm::ivec2(TTile::kSize - 1));
+			const auto& depth = frame.triangleSetups.depth[triangleIdx];
+			auto& minDepth = keptMinDepth[(yTile - binMinTile.y) * kBinTiles + (xTile - binMinTile.x)];
+
+			//A triangle covering the whole tile and lying in front of everything binned before overwrites every pixel of them,
+			//so they would be rasterized for nothing. The triangle has to be nearer by the depth rounding margin,
+			//surfaces closer than that to each other keep every entry.
+			if (coversTile)
 			{
-				const auto framebufferX = xTile * Tile::kSize + xPixel;
-				const auto framebufferY = yTile * Tile::kSize + yPixel;
-				if (framebufferX >= m_framebuffer.screenSize.x || framebufferY >= m_framebuffer.screenSize.y)
+				binCovering++;
+				if (depth.maxDepth + TriangleDepth::kMargin < minDepth)
 				{
-					continue;
+					binDiscarded += binning.tileCounts[tileIdx];
+					binning.tileCounts[tileIdx] = 0;
+					minDepth = std::numeric_limits<float>::infinity();
 				}
-
-				const auto outIdx = framebufferY * size_t(m_framebuffer.screenSize.x) + framebufferX;
-				m_postProcessing.color[outIdx] = tile.colorAt(xPixel, yPixel);
-				m_postProcessing.normal[outIdx] = tile.normalAt(xPixel, yPixel);
-				m_postProcessing.depth[outIdx] = tile.depthAt(xPixel, yPixel);
 			}
+
+			binTileEntries[binning.tileOffsets[tileIdx] + binning.tileCounts[tileIdx]++] = TileEntry::make(triangleIdx, coversTile);
+			minDepth = std::min(minDepth, depth.minDepth);
+		});
+		tileEntries.fetch_add(binEntries, std::memory_order_relaxed);
+		tileRejected.fetch_add(rejected, std::memory_order_relaxed);
+		tileCovering.fetch_add(binCovering, std::memory_order_relaxed);
+		tileDiscarded.fetch_add(binDiscarded, std::memory_order_relaxed);
+
+		TileCounters binCounters;
+		forEachBinTile(bin, [&](unsigned xTile, unsigned yTile)
+		{
+			binCounters += rasterizeTile<TTile>(frame, xTile, yTile, binTileEntries);
+		});
+		tileOccluded.fetch_add(binCounters.occludedTriangles, std::memory_order_relaxed);
+		shadedFragments.fetch_add(binCounters.shadedFragments, std::memory_order_relaxed);
+	};
+
+	//Every bin of the schedule before this one is taken, so the search for a complete bin starts here.
+	//The bins never get untaken, so a stale value only makes the search longer.
+	std::atomic_size_t firstPending{ 0 };
+	const auto takeCompleteBin = [&]() -> std::optional<uint32_t>
+	{
+		for (auto idx = firstPending.load(std::memory_order_relaxed); idx < binning.schedule.size(); ++idx)
+		{
+			auto& progress = binning.progress[binning.schedule[idx]];
+			if (progress.taken.load(std::memory_order_relaxed) || progress.written.load(std::memory_order_acquire) != progress.entries)
+				continue;
+			if (progress.taken.exchange(true, std::memory_order_acq_rel))
+				continue;
+
+			auto pending = firstPending.load(std::memory_order_relaxed);
+			while (pending < binning.schedule.size() && binning.progress[binning.schedule[pending]].taken.load(std::memory_order_relaxed))
+				pending++;
+			firstPending.store(pending, std::memory_order_relaxed);
+
+			return binning.schedule[idx];
 		}
+		return std::nullopt;
+	};
+
+	//The bins are the nodes of a small task graph, the tasks get spawned as their inputs get ready. A bin rasterizes once
+	//all the triangles touching it are binned, so the chunk completing a bin hands it over right away, and the threads
+	//done with the binning start on it while the others still write the last entries. The screen-space shadows trace
+	//the depth of the whole screen though, so the last bin rasterized spawns the post-processing of all of them.
+	//No task waits for another, so the thread of any other loop may run one while waiting for its own.
+	//The indices of the loop: the chunks of triangles, then a task per complete bin, which takes the heaviest bin
+	//complete by then (see the schedule) rather than its own, then the post-processing of every bin.
+	const auto trianglesChunks = (setups.size() + kTrianglesGrain - 1) / kTrianglesGrain;
+	const auto firstRasterization = trianglesChunks;
+	const auto firstPostProcessing = trianglesChunks + binsCount;
+	const auto emptyBins = size_t(std::count_if(binning.progress, binning.progress + binsCount, [](const CoarseBin::Progress& progress)
+	{
+		return progress.entries == 0;
+	}));
+
+	//per thread of the job system, the one calling draw is the only one from outside the pool
+	binning.workerMilliseconds.assign(m_jobSystem.concurrency(), 0.0);
+	std::atomic_size_t rasterizedBins{ 0 };
+
+	//the empty bins are complete from the start
+	m_jobSystem.parallelForGrowing(trianglesChunks + emptyBins, kBinsGrain, [&](size_t idx, const auto& spawn)
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		if (idx < firstRasterization)
+		{
+			writeEntries(idx, [&](size_t binIdx) { spawn(firstRasterization + binIdx, firstRasterization + binIdx + 1); });
+		}
+		else if (idx < firstPostProcessing)
+		{
+			//The bin of this task may have gone to another one for a heavier bin, whose completion this thread
+			//may not see yet. There's a complete bin left for every task though, so another look finds it.
+			auto binIdx = takeCompleteBin();
+			while (!binIdx)
+				binIdx = takeCompleteBin();
+
+			rasterizeBin(coarseGrid[*binIdx]);
+			if (rasterizedBins.fetch_add(1, std::memory_order_acq_rel) + 1 == binsCount)
+				spawn(firstPostProcessing, firstPostProcessing + binsCount);
+		}
+		else
+		{
+			postProcessBin(frame, coarseGrid[idx - firstPostProcessing]);
+		}
+
+		binning.workerMilliseconds[m_jobSystem.currentThread()] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 	});
+
+	//the workers finding nothing left to do on a small frame would drag the mean down
+	const auto& workerMilliseconds = binning.workerMilliseconds;
+	const auto busyWorkers = std::count_if(workerMilliseconds.cbegin(), workerMilliseconds.cend(), [](double milliseconds) { return milliseconds > 0.0; });
+	const auto maxWorker = *std::max_element(workerMilliseconds.cbegin(), workerMilliseconds.cend());
+	const auto meanWorker = busyWorkers != 0 ? std::accumulate(workerMilliseconds.cbegin(), workerMilliseconds.cend(), 0.0) / double(busyWorkers) : 0.0;
+	m_statistics.rasterizationWorkers = unsigned(workerMilliseconds.size());
+	m_statistics.rasterizationImbalance = meanWorker > 0.0 ? float(maxWorker / meanWorker) : 1.0f;
+
+	m_statistics.tileBinEntries = tileEntries.load();
+	m_statistics.tileBinEntriesRejected = tileRejected.load();
+	m_statistics.tileBinEntriesCovering = tileCovering.load();
+	m_statistics.tileBinEntriesDiscarded = tileDiscarded.load();
+	m_statistics.tileBinEntriesOccluded = tileOccluded.load();
+	m_statistics.shadedFragments = shadedFragments.load();
 }
 
-void Rasterizer::postProcessingStage()
+template <typename TTile>
+TileCounters Rasterizer::rasterizeTile(const Frame& frame, unsigned xTile, unsigned yTile, uint32_t* binTileEntries)
 {
-	const auto totalPixels = size_t(m_framebuffer.screenSize.x) * size_t(m_framebuffer.screenSize.y);
-	m_postProcessing.lit.resize(totalPixels);
-	m_postProcessing.output.resize(totalPixels);
+	auto& binning = m_pipeline.binning;
+	const auto tileIdx = size_t(m_framebuffer.gridDim.x) * yTile + xTile;
+	const auto firstPixel = tileIdx * TTile::kPixels;
+
+	const auto tileMin = glm::vec2(xTile, yTile) * glm::vec2(TTile::kSize);
+	const auto tileMax = tileMin + glm::vec2(TTile::kSize);
+
+	const auto tileBox = BoundingBox2D{ tileMin, tileMax };
 
-	const auto viewportProjection = m_pipeline.matrices.viewport * m_pipeline.matrices.projection;
+	auto tile = TTile
+	{
+		binTileEntries + binning.tileOffsets[tileIdx],
+		binTileEntries + binning.tileOffsets[tileIdx] + binning.tileCounts[tileIdx],
+		m_framebuffer.color.data() + firstPixel,
+		m_framebuffer.normal.data() + firstPixel,
+		m_framebuffer.depth.data() + firstPixel
+	};
+	const auto counters = tile.rasterize(tileBox, { m_texture, frame.triangleSetups, m_frameArena }, m_options.frontToBackOrder);
+
+	//the tiles on the right and bottom edges may stick out of the screen
+	const auto framebufferX = xTile * TTile::kSize;
+	const auto rowPixels = glm::min(size_t(TTile::kSize), size_t(m_framebuffer.screenSize.x) - framebufferX);
+	for (size_t yPixel = 0; yPixel < TTile::kSize; ++yPixel)
+	{
+		const auto framebufferY = yTile * TTile::kSize + yPixel;
+		if (framebufferY >= m_framebuffer.screenSize.y)
+			break;
+
+		const auto inIdx = firstPixel + yPixel * TTile::kSize;
+		const auto outIdx = framebufferY * size_t(m_framebuffer.screenSize.x) + framebufferX;
+		std::copy_n(m_framebuffer.color.cbegin() + inIdx, rowPixels, m_postProcessing.color.begin() + outIdx);
+		std::copy_n(m_framebuffer.normal.cbegin() + inIdx, rowPixels, m_postProcessing.normal.begin() + outIdx);
+		std::copy_n(m_framebuffer.depth.cbegin() + inIdx, rowPixels, m_postProcessing.depth.begin() + outIdx);
+	}
+
+	return counters;
+}
+
+void Rasterizer::postProcessBin(const Frame& frame, const CoarseBin& bin)
+{
+	const auto binIdx = &bin - m_framebuffer.coarseGrid.data();
+	const auto [yBin, xBin] = std::div(binIdx, m_framebuffer.coarseGridDim.x);
+	const auto minPixel = glm::uvec2(xBin, yBin) * glm::uvec2(CoarseBin::kSize);
+	const auto maxPixel = glm::min(minPixel + glm::uvec2(CoarseBin::kSize), m_framebuffer.screenSize);
+
+	const auto viewportProjection = frame.matrices.viewport * frame.matrices.projection;
 	const auto inverseViewportProjection = glm::inverse(viewportProjection);
 
 	// screen-space shadows
-	std::for_each(TRY_PARALLELIZE_PAR_UNSEQ m_postProcessing.lit.begin(), m_postProcessing.lit.end(), [&](char& lit)
+	const auto traceShadow = [&](size_t idx)
 	{
 		constexpr auto kSteps = 32;
 		constexpr auto kMaxDistance = 2.0f;
 		constexpr auto kStepLength = kMaxDistance / kSteps;
 
-		const auto idx = std::distance(m_postProcessing.lit.data(), &lit);
-		const auto [yPixel, xPixel] = std::div(idx, m_framebuffer.screenSize.x);
+		auto& lit = m_postProcessing.lit[idx];
+		const auto [yPixel, xPixel] = std::div(ptrdiff_t(idx), ptrdiff_t(m_framebuffer.screenSize.x));
 
 		const auto fragmentPos = inverseViewportProjection * glm::vec4(xPixel, yPixel, m_postProcessing.depth[idx], 1.0f);
 		auto samplePos = fragmentPos / fragmentPos.w;
@@ -237,29 +1026,37 @@ void Rasterizer::postProcessingStage()
 			}
 		}
 		lit = true;
-	});
+	};
 
 	// lighting pass
-	std::for_each(TRY_PARALLELIZE_PAR_UNSEQ m_postProcessing.output.begin(), m_postProcessing.output.end(), [&](glm::vec4& out)
+	const auto shade = [&](size_t idx)
 	{
-		const auto idx = std::distance(m_postProcessing.output.data(), &out);
 		const auto normal = m_postProcessing.normal[idx];
 		const auto color = m_postProcessing.color[idx];
 		const auto occluded = m_postProcessing.lit[idx];
 
 		//Lambertian BRDF
 		const auto diffuse = glm::clamp(glm::dot(normal, m_parameters.lightDir) * float(occluded), 0.01f, 1.0f);
-		out = glm::vec4(diffuse * color.rgb(), 1.0f);
-	});
+		m_postProcessing.output[idx] = glm::vec4(diffuse * color.rgb(), 1.0f);
+	};
+
+	//the whole shadow mask of the bin first, then the lighting reads it while it's still in the cache
+	for (auto yPixel = minPixel.y; yPixel != maxPixel.y; ++yPixel)
+		for (auto xPixel = minPixel.x; xPixel != maxPixel.x; ++xPixel)
+			traceShadow(size_t(m_framebuffer.screenSize.x) * yPixel + xPixel);
+
+	for (auto yPixel = minPixel.y; yPixel != maxPixel.y; ++yPixel)
+		for (auto xPixel = minPixel.x; xPixel != maxPixel.x; ++xPixel)
+			shade(size_t(m_framebuffer.screenSize.x) * yPixel + xPixel);
 }
 
 void Rasterizer::swapBuffers(std::vector<gamma_bgra_t>& out)
 {
 	out.resize(size_t(m_framebuffer.screenSize.x) * size_t(m_framebuffer.screenSize.y));
 
-	std::for_each(TRY_PARALLELIZE_PAR_UNSEQ out.begin(), out.end(), [&](gamma_bgra_t& result)
+	m_jobSystem.parallelFor(out.size(), kPixelsGrain, [&](size_t idx)
 	{
-		const auto idx = std::distance(out.data(), &result);
+		auto& result = out[idx];
 		const auto color = m_postProcessing.output[idx];
 
 		//const auto corrected = glm::pow(color, glm::vec4(1.0f / 2.2f));
@@ -1,121 +1,290 @@
+#include <algorithm>
+
 #include <rasterizer/Texture.hpp>
 
 #include "BoundingBox2D.hpp"
+#include "FrameArena.hpp"
+#include "JobSystem.hpp"
+#include "simd.hpp"
 #include "Tile.hpp"
+#include "TriangleSetup.hpp"
 
 namespace rasterizer {
 
-template<typename T>
-static T interpolate(const glm::vec3& barycentricPerZ, float interpolatedOriginalZ, const T& f1, const T& f2, const T& f3)
+#ifdef SIMD_RASTERIZATION
+//pixel coordinates inside the tile in the storage order, so that a SIMD block loads its lanes' positions at once
+template <size_t TSize>
+static constexpr std::array<std::array<float, TSize * TSize>, 2> makePixelCoords() noexcept
 {
-	return interpolatedOriginalZ * (barycentricPerZ.x * f1 + barycentricPerZ.y * f2 + barycentricPerZ.z * f3);
+	static_assert((TSize * TSize) % simd::kWidth == 0, "a tile must consist of whole SIMD blocks");
+
+	std::array<std::array<float, TSize * TSize>, 2> result{};
+	for (size_t i = 0; i != TSize * TSize; ++i)
+	{
+		result[0][i] = float(i % TSize);
+		result[1][i] = float(i / TSize);
+	}
+	return result;
 }
 
-void Tile::scheduleTriangle(const std::array<Vertex, 3>& triangle) noexcept
+template <size_t TSize>
+static constexpr auto kPixelCoords = makePixelCoords<TSize>();
+#endif
+
+template <size_t TSize>
+Tile<TSize>::Tile(uint32_t* trianglesBegin, uint32_t* trianglesEnd, glm::vec4* color, glm::vec3* normal, float* depth) noexcept :
+	m_trianglesBegin(trianglesBegin),
+	m_trianglesEnd(trianglesEnd),
+	m_color(color),
+	m_normal(normal),
+	m_depth(depth)
 {
-	while (m_lock->exchange(true, std::memory_order::memory_order_acquire)) {};
-	m_triangles.emplace_back(&triangle);
-	m_lock->store(false, std::memory_order::memory_order_release);
 }
 
-void Tile::rasterize(const BoundingBox2D& tileBox, const UniformData& uniforms) noexcept
+template <size_t TSize>
+TileCounters Tile<TSize>::rasterize(const BoundingBox2D& tileBox, const UniformData& uniforms, bool frontToBack) noexcept
 {
-	std::fill(m_color.begin(), m_color.end(), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
-	std::fill(m_normal.begin(), m_normal.end(), glm::vec3(0.0f));
-	std::fill(m_depth.begin(), m_depth.end(), 1.0f);
+	std::fill_n(m_color, kPixels, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	std::fill_n(m_normal, kPixels, glm::vec3(0.0f));
+	std::fill_n(m_depth, kPixels, 1.0f);
+	m_rowMaxDepth.fill(1.0f);
+	m_maxDepth = 1.0f;
 
-	for (const auto& trianglePtr : m_triangles)
+	if (frontToBack)
 	{
-		const auto& triangle = *trianglePtr;
+		//Sorting packed (depth, id, covers) keys is cheaper than chasing the depths through the ids, and needs no heap buffer
+		//unlike std::stable_sort. The ids of a tile come in the binning order, so breaking the ties by them keeps
+		//the result deterministic. The depths are non-negative, so their bits order the same way, +0.0f folds -0.0f.
+		const auto& depth = uniforms.triangles.depth;
+		const auto count = size_t(m_trianglesEnd - m_trianglesBegin);
+		const auto keys = uniforms.arena.allocate<uint64_t>(count);
 
-		for (size_t y = 0; y != kSize; ++y)
+		std::transform(m_trianglesBegin, m_trianglesEnd, keys, [&depth](uint32_t entry)
+		{
+			const auto triangle = TileEntry::triangle(entry);
+			return (uint64_t(glm::floatBitsToUint(depth[triangle].minDepth + 0.0f)) << 32) | (uint64_t(triangle) << 1) | uint64_t(TileEntry::coversTile(entry));
+		});
+		sequentialSort(keys, keys + count);
+		std::transform(keys, keys + count, m_trianglesBegin, [](uint64_t key)
+		{
+			return TileEntry::make(uint32_t(key & 0xFFFFFFFF) >> 1, key & 1);
+		});
+	}
+
+	const auto tileMin = glm::ivec2(tileBox.min());
+
+	Counters counters;
+	//the culling stage leaves only front-facing triangles with a non-zero area
+	for (auto it = m_trianglesBegin; it != m_trianglesEnd; ++it)
+	{
+		const auto triangle = TileEntry::triangle(*it);
+		const auto coversTile = TileEntry::coversTile(*it);
+
+		//the whole triangle is behind every pixel of the tile, so it can't pass the depth test anywhere
+		if (uniforms.triangles.depth[triangle].minDepth > m_maxDepth + TriangleDepth::kMargin)
+		{
+			counters.occludedTriangles++;
+			continue;
+		}
+
+		const auto& edges = uniforms.triangles.edges[triangle];
+		const auto minPixel = glm::max(edges.minPixel - tileMin, glm::ivec2(0));
+		const auto maxPixel = glm::min(edges.maxPixel - tileMin, glm::ivec2(kSize - 1));
+
+		//a small triangle touches only a few pixels of the tile, so only those get visited
+#ifdef SIMD_RASTERIZATION
+		const auto shaded = rasterizeSimd(tileBox, uniforms, triangle, minPixel, maxPixel, coversTile);
+#else
+		const auto shaded = rasterizeScalar(tileBox, uniforms, triangle, minPixel, maxPixel, coversTile);
+#endif
+		counters.shadedFragments += shaded;
+
+		//every shaded fragment wrote the depth, and only the rows of the triangle's bounds can have got nearer
+		if (shaded != 0)
+		{
+			for (auto y = size_t(minPixel.y); y <= size_t(maxPixel.y); ++y)
+				m_rowMaxDepth[y] = *std::max_element(m_depth + y * kSize, m_depth + (y + 1) * kSize);
+			m_maxDepth = *std::max_element(m_rowMaxDepth.cbegin(), m_rowMaxDepth.cend());
+		}
+	}
+
+	return counters;
+}
+
+template <size_t TSize>
+size_t Tile<TSize>::rasterizeScalar(const BoundingBox2D& tileBox, const UniformData& uniforms, uint32_t triangle, const glm::ivec2& minPixel, const glm::ivec2& maxPixel, bool coversTile) noexcept
+{
+	const auto& triangleEdges = uniforms.triangles.edges[triangle];
+	const auto tileOffset = tileBox.min() - triangleEdges.origin;
+	size_t shaded = 0;
+
+	//the same loop either for float or for integer edge functions
+	const auto scan = [&](auto rowEdges, const auto& edgesDx, const auto& edgesDy)
+	{
+		for (int y = minPixel.y; y <= maxPixel.y; ++y, rowEdges += edgesDy)
 		{
 			const auto stride = y * kSize;
-			for (size_t x = 0; x != kSize; ++x)
+			auto edges = rowEdges;
+			for (int x = minPixel.x; x <= maxPixel.x; ++x, edges += edgesDx)
 			{
-				const auto point = tileBox.min() + glm::vec2(x, y);
-				const auto areas = barycentric(triangle[0].position, triangle[1].position, triangle[2].position, point);
-				//render only the front side
-				if (!(areas.x >= 0.0f && areas.y >= 0.0f && areas.z >= 0.0f))
+				if (!coversTile && !(edges.x >= 0 && edges.y >= 0 && edges.z >= 0))
 					continue;
-				const auto barycentricPos = glm::vec3(areas) / areas.w;
-
-				/*if (barycentricPos.x > 0.01f && barycentricPos.y > 0.01f && barycentricPos.z > 0.01f)
-					continue;*/
-
-				//render both sides of the triangle
-				/*if (!(barycentricPos.x >= 0.0f && barycentricPos.y >= 0.0f && barycentricPos.z >= 0.0f))
-					continue;*/
 
 				const auto idx = stride + x;
-				drawImpl(uniforms, triangle, barycentricPos, m_color[idx], m_normal[idx], m_depth[idx]);
+				shaded += drawImpl(uniforms, triangle, tileOffset + glm::vec2(x, y), m_color[idx], m_normal[idx], m_depth[idx]);
 			}
 		}
+	};
+
+	if (triangleEdges.fixedPoint)
+	{
+		const auto& fixed = triangleEdges.fixed;
+		scan(fixed.edgesAt(glm::ivec2(tileBox.min()) + minPixel), fixed.edgesDx * fixed.kSubpixelScale, fixed.edgesDy * fixed.kSubpixelScale);
+	}
+	else
+	{
+		scan(triangleEdges.edgesAt(tileBox.min() + glm::vec2(minPixel)), triangleEdges.edgesDx, triangleEdges.edgesDy);
 	}
 
-	m_triangles.clear();
+	return shaded;
 }
 
-glm::vec4 Tile::colorAt(size_t x, size_t y) const noexcept
+#ifdef SIMD_RASTERIZATION
+//The same as rasterizeScalar + drawImpl, but a block of simd::kWidth pixels at a time.
+//Only texture sampling remains per pixel since it's a gather.
+template <size_t TSize>
+size_t Tile<TSize>::rasterizeSimd(const BoundingBox2D& tileBox, const UniformData& uniforms, uint32_t triangle, const glm::ivec2& minPixel, const glm::ivec2& maxPixel, bool coversTile) noexcept
 {
-	return m_color[y * kSize + x];
-}
+	using simd::float_v;
+	size_t shaded = 0;
 
-glm::vec3 Tile::normalAt(size_t x, size_t y) const noexcept
-{
-	return m_normal[y * kSize + x];
-}
+	const auto& triangleEdges = uniforms.triangles.edges[triangle];
+	const auto& depthPlane = uniforms.triangles.depth[triangle].depth;
 
-float Tile::depthAt(size_t x, size_t y) const noexcept
-{
-	return m_depth[y * kSize + x];
-}
+	const auto tileOffset = tileBox.min() - triangleEdges.origin;
+	const auto tileEdges = triangleEdges.edgesAt(tileBox.min());
+	const auto fixedTileEdges = triangleEdges.fixedPoint ? triangleEdges.fixed.edgesAt(glm::ivec2(tileBox.min())) : glm::i64vec3(0);
+	const auto fixedEdgesDx = triangleEdges.fixed.edgesDx * triangleEdges.fixed.kSubpixelScale;
+	const auto fixedEdgesDy = triangleEdges.fixed.edgesDy * triangleEdges.fixed.kSubpixelScale;
 
-glm::uvec2 Tile::computeGridDim(glm::uvec2 screenSize) noexcept
-{
-	return (screenSize - glm::uvec2(1)) / glm::uvec2(kSize) + glm::uvec2(1);
+	//only the blocks holding the rows of the triangle, and its columns if a row spans several blocks
+	const auto firstBlock = size_t(minPixel.y) * kSize / simd::kWidth * simd::kWidth;
+	const auto endBlock = (size_t(maxPixel.y) + 1) * kSize;
+	for (size_t block = firstBlock; block < endBlock; block += simd::kWidth)
+	{
+		if constexpr (kSize > simd::kWidth)
+		{
+			const auto column = int(block % kSize);
+			if (column > maxPixel.x || column + int(simd::kWidth) <= minPixel.x)
+				continue;
+		}
+
+		const auto x = float_v::load(&kPixelCoords<TSize>[0][block]);
+		const auto y = float_v::load(&kPixelCoords<TSize>[1][block]);
+
+		auto covered = float_v{};
+		if (coversTile)
+		{
+			covered = simd::fromBitmask((1 << simd::kWidth) - 1);
+		}
+		else if (triangleEdges.fixedPoint)
+		{
+			//64-bit integer lanes are too narrow to pay off, so the exact coverage is computed per lane
+			int coverage = 0;
+			for (size_t lane = 0; lane != simd::kWidth; ++lane)
+			{
+				const auto edges = fixedTileEdges + fixedEdgesDx * int64_t(kPixelCoords<TSize>[0][block + lane]) + fixedEdgesDy * int64_t(kPixelCoords<TSize>[1][block + lane]);
+				coverage |= int(edges.x >= 0 && edges.y >= 0 && edges.z >= 0) << lane;
+			}
+			covered = simd::fromBitmask(coverage);
+		}
+		else
+		{
+			covered =
+				simd::nonNegative(simd::plane(tileEdges.x, triangleEdges.edgesDx.x, triangleEdges.edgesDy.x, x, y)) &
+				simd::nonNegative(simd::plane(tileEdges.y, triangleEdges.edgesDx.y, triangleEdges.edgesDy.y, x, y)) &
+				simd::nonNegative(simd::plane(tileEdges.z, triangleEdges.edgesDx.z, triangleEdges.edgesDy.z, x, y));
+		}
+
+		if (simd::bitmask(covered) == 0)
+			continue;
+
+		const auto offsetX = x + float_v::broadcast(tileOffset.x);
+		const auto offsetY = y + float_v::broadcast(tileOffset.y);
+
+		// depth test
+		const auto interpolatedNormalizedZ = simd::plane(depthPlane.origin, depthPlane.ddx, depthPlane.ddy, offsetX, offsetY);
+		const auto depth = float_v::load(&m_depth[block]);
+		const auto passed = covered & simd::notGreater(interpolatedNormalizedZ, depth);
+
+		const auto mask = simd::bitmask(passed);
+		if (mask == 0)
+			continue;
+
+		//depth write
+		simd::select(passed, interpolatedNormalizedZ, depth).store(&m_depth[block]);
+
+		//perspective correct interpolations, the attributes get loaded only for the triangles passing the depth test
+		const auto& attributes = uniforms.triangles.attributes[triangle];
+		const auto& invW = attributes.invW;
+		const auto& tc = attributes.texCoord0PerW;
+		const auto& n = attributes.normalPerW;
+
+		const auto interpolatedOriginalZ = float_v::broadcast(1.0f) / simd::plane(invW.origin, invW.ddx, invW.ddy, offsetX, offsetY);
+		const auto u = simd::plane(tc.origin.x, tc.ddx.x, tc.ddy.x, offsetX, offsetY) * interpolatedOriginalZ;
+		const auto v = simd::plane(tc.origin.y, tc.ddx.y, tc.ddy.y, offsetX, offsetY) * interpolatedOriginalZ;
+
+		const auto nx = simd::plane(n.origin.x, n.ddx.x, n.ddy.x, offsetX, offsetY);
+		const auto ny = simd::plane(n.origin.y, n.ddx.y, n.ddy.y, offsetX, offsetY);
+		const auto nz = simd::plane(n.origin.z, n.ddx.z, n.ddy.z, offsetX, offsetY);
+		const auto invLength = float_v::broadcast(1.0f) / simd::sqrt(nx * nx + ny * ny + nz * nz);
+
+		std::array<std::array<float, simd::kWidth>, 5> lanes;
+		u.store(lanes[0].data());
+		v.store(lanes[1].data());
+		(nx * invLength).store(lanes[2].data());
+		(ny * invLength).store(lanes[3].data());
+		(nz * invLength).store(lanes[4].data());
+
+		for (size_t lane = 0; lane != simd::kWidth; ++lane)
+		{
+			if (!(mask & (1 << lane)))
+				continue;
+
+			m_color[block + lane] = uniforms.texture.sample({ lanes[0][lane], lanes[1][lane] });
+			m_normal[block + lane] = { lanes[2][lane], lanes[3][lane], lanes[4][lane] };
+			shaded++;
+		}
+	}
+
+	return shaded;
 }
+#endif
 
-void Tile::drawImpl(const UniformData& uniforms, const std::array<Vertex, 3>& triangle, glm::vec3 barycentricPos, glm::vec4& color, glm::vec3& normal, float& depth) noexcept
+template <size_t TSize>
+bool Tile<TSize>::drawImpl(const UniformData& uniforms, uint32_t triangle, const glm::vec2& offset, glm::vec4& color, glm::vec3& normal, float& depth) noexcept
 {
-	const auto barycentricPerZ = barycentricPos / glm::vec3(triangle[0].position.w, triangle[1].position.w, triangle[2].position.w);					// (alpha/Za, beta/Zb, gamma/Zc)
-	const auto interpolatedOriginalZ = 1.0f / (barycentricPerZ.x + barycentricPerZ.y + barycentricPerZ.z);												// 1 / (alpha/Za + beta/Zb + gamma/Zc)
-	const auto interpolatedNormalizedZ = glm::dot(barycentricPos, glm::vec3(triangle[0].position.z, triangle[1].position.z, triangle[2].position.z));	// alpha * Zna + beta * Znb + gamma * Znb
+	const auto interpolatedNormalizedZ = uniforms.triangles.depth[triangle].depth.at(offset);		// alpha * Zna + beta * Znb + gamma * Znb
 
 	// depth test
 	if (interpolatedNormalizedZ > depth)
-		return;
+		return false;
 	//depth write
 	depth = interpolatedNormalizedZ;
 
 	//perspective correct interpolations
-	const auto interpolatedNormal = interpolate(barycentricPerZ, interpolatedOriginalZ, triangle[0].normal, triangle[1].normal, triangle[2].normal);
-	const auto interpolatedTc = interpolate(barycentricPerZ, interpolatedOriginalZ, triangle[0].texCoord0, triangle[1].texCoord0, triangle[2].texCoord0);
+	const auto& attributes = uniforms.triangles.attributes[triangle];
+	const auto interpolatedOriginalZ = 1.0f / attributes.invW.at(offset);	// 1 / (alpha/Za + beta/Zb + gamma/Zc)
+	const auto interpolatedTc = attributes.texCoord0PerW.at(offset) * interpolatedOriginalZ;
 
 	color = uniforms.texture.sample(interpolatedTc);
-	normal = glm::normalize(interpolatedNormal.xyz());
+	//the normalization makes the multiplication by the interpolated Z redundant
+	normal = glm::normalize(attributes.normalPerW.at(offset));
+	return true;
 }
 
-glm::vec4 Tile::barycentric(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c, const glm::vec2& point) noexcept
-{
-	//the same as `glm::cross(x,y).z`;
-	constexpr auto edgeFunc = [](const glm::vec3& x, const glm::vec3& y)
-	{
-		return x.x * y.y - y.x * x.y;
-	};
+template class Tile<kTileSizes[0]>;
+template class Tile<kTileSizes[1]>;
+template class Tile<kTileSizes[2]>;
 
-	const auto Sa = edgeFunc(glm::vec3(c - b, 0.0f), glm::vec3(point - b, 0.0f));
-	const auto Sb = edgeFunc(glm::vec3(a - c, 0.0f), glm::vec3(point - c, 0.0f));
-	const auto Sc = edgeFunc(glm::vec3(b - a, 0.0f), glm::vec3(point - a, 0.0f));
-
-	const auto S = Sa + Sb + Sc;
-	return
-	{
-		Sa,
-		Sb,
-		Sc,
-		S
-	};
 }
-
-}
\ No newline at end of file
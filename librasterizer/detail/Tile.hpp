@@ -1,53 +1,108 @@
 #pragma once
 
 #include <array>
-#include <atomic>
-#include <memory>
+#include <cstdint>
 #include <vector>
 
 #include "glm-include.hpp"
-#include "Vertex.hpp"
 
 namespace rasterizer {
 
 class Texture;
 class BoundingBox2D;
+class FrameArena;
+struct TriangleSetups;
 
+struct TileUniformData
+{
+	Texture& texture;
+	const TriangleSetups& triangles;
+	FrameArena& arena;		// the per-frame scratch memory
+};
+
+struct TileCounters
+{
+	size_t occludedTriangles{ 0 };	// rejected for the whole tile by the hierarchical depth test
+	size_t shadedFragments{ 0 };	// passed the depth test and got shaded, overwritten ones included
+
+	TileCounters& operator+= (const TileCounters& other) noexcept
+	{
+		occludedTriangles += other.occludedTriangles;
+		shadedFragments += other.shadedFragments;
+		return *this;
+	}
+};
+
+//A tile entry is a triangle id, the highest bit marks the triangles covering every pixel of the tile.
+//The binning decides it with the corner tests once per tile, so the tile skips the coverage test for such triangles.
+struct TileEntry
+{
+	static constexpr uint32_t kCoversTile = uint32_t(1) << 31;
+
+	static uint32_t make(uint32_t triangle, bool coversTile) noexcept;
+	static uint32_t triangle(uint32_t entry) noexcept;
+	static bool coversTile(uint32_t entry) noexcept;
+};
+
+inline uint32_t TileEntry::make(uint32_t triangle, bool coversTile) noexcept
+{
+	return triangle | (coversTile ? kCoversTile : 0);
+}
+
+inline uint32_t TileEntry::triangle(uint32_t entry) noexcept
+{
+	return entry & ~kCoversTile;
+}
+
+inline bool TileEntry::coversTile(uint32_t entry) noexcept
+{
+	return entry & kCoversTile;
+}
+
+//The tile kernels are specialized at compile time, so the rasterizer picks one of these sizes
+//at runtime (see Rasterizer::Options::tileSize). Tile.cpp instantiates every size.
+constexpr std::array<size_t, 3> kTileSizes{ 4, 8, 16 };
+
+//A view of a single tile over the grid-wide storage: the tile's range of the shared triangle index buffer
+//and its part of the G-buffer, where the pixels of every tile are contiguous and row-major.
+//It's created by the worker owning the tile just to rasterize it, so the grid costs no per-tile allocations.
+template <size_t TSize>
 class Tile final
 {
 public:
-	struct UniformData
-	{
-		Texture& texture;
-	};
+	typedef TileUniformData UniformData;
+	typedef TileCounters Counters;
 
-	static constexpr size_t kSize = TILE_SIZE; //see CMakeLists.txt
+	static constexpr size_t kSize = TSize;
+	static constexpr size_t kPixels = kSize * kSize;
 
-	Tile() = default;
+	Tile(uint32_t* trianglesBegin, uint32_t* trianglesEnd, glm::vec4* color, glm::vec3* normal, float* depth) noexcept;
 	Tile(const Tile&) = delete;
-	Tile(Tile&&) noexcept = default;
 	~Tile() = default;
 
 	Tile& operator= (const Tile&) = delete;
-	Tile& operator=(Tile&&) noexcept = default;
 
-	void scheduleTriangle(const std::array<Vertex, 3>& triangle) noexcept;
-	void rasterize(const BoundingBox2D& tileBox, const UniformData& uniforms) noexcept;
-	glm::vec4 colorAt(size_t x, size_t y) const noexcept;
-	glm::vec3 normalAt(size_t x, size_t y) const noexcept;
-	float depthAt(size_t x, size_t y) const noexcept;
+	//frontToBack sorts the triangles by their nearest depth first, so fewer fragments get shaded and overwritten
+	Counters rasterize(const BoundingBox2D& tileBox, const UniformData& uniforms, bool frontToBack) noexcept;
 
-	static glm::uvec2 computeGridDim(glm::uvec2 screenSize) noexcept;
 private:
-	std::vector<const std::array<Vertex, 3>*> m_triangles;
-	std::array<glm::vec4, kSize * kSize> m_color{};
-	std::array<glm::vec3, kSize* kSize> m_normal{};
-	std::array<float, kSize* kSize> m_depth{};
-	std::unique_ptr<std::atomic_bool> m_lock{std::make_unique<std::atomic_bool>(false)};
+	uint32_t* m_trianglesBegin;		// TileEntry values, ids in TriangleSetups
+	uint32_t* m_trianglesEnd;
+	glm::vec4* m_color;				// kPixels each
+	glm::vec3* m_normal;
+	float* m_depth;
+	std::array<float, kSize> m_rowMaxDepth;	// the farthest depth of every row
+	float m_maxDepth{ 1.0f };	// conservative, no pixel of the tile is farther
 
-	void drawImpl(const UniformData& uniforms, const std::array<Vertex, 3>& triangle, glm::vec3 barycentricPos, glm::vec4& color, glm::vec3& normal, float& depth) noexcept;
-
-	static glm::vec4 barycentric(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c, const glm::vec2& point) noexcept;
+	//Both visit only the pixels within [minPixel, maxPixel], the triangle's bounds inside the tile,
+	//skip the coverage test if the triangle covers the whole tile and return the number of shaded fragments.
+	size_t rasterizeScalar(const BoundingBox2D& tileBox, const UniformData& uniforms, uint32_t triangle, const glm::ivec2& minPixel, const glm::ivec2& maxPixel, bool coversTile) noexcept;
+	size_t rasterizeSimd(const BoundingBox2D& tileBox, const UniformData& uniforms, uint32_t triangle, const glm::ivec2& minPixel, const glm::ivec2& maxPixel, bool coversTile) noexcept; //see simd.hpp
+	bool drawImpl(const UniformData& uniforms, uint32_t triangle, const glm::vec2& offset, glm::vec4& color, glm::vec3& normal, float& depth) noexcept;
 };
 
+extern template class Tile<kTileSizes[0]>;
+extern template class Tile<kTileSizes[1]>;
+extern template class Tile<kTileSizes[2]>;
+
 }
\ No newline at end of file
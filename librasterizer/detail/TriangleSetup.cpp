@@ -0,0 +1,139 @@
+#include "BoundingBox2D.hpp"
+#include "ProjectedTriangles.hpp"
+#include "TriangleSetup.hpp"
+
+namespace rasterizer {
+
+template<typename T>
+static Plane<T> makePlane(const glm::vec3& edgesDx, const glm::vec3& edgesDy, float invArea, const T& f1, const T& f2, const T& f3) noexcept
+{
+	//barycentric coordinates are (Sa, Sb, Sc) / S, so the gradient of their weighted sum is a weighted sum of the edge gradients
+	return
+	{
+		f1,
+		(f1 * edgesDx.x + f2 * edgesDx.y + f3 * edgesDx.z) * invArea,
+		(f1 * edgesDy.x + f2 * edgesDy.y + f3 * edgesDy.z) * invArea
+	};
+}
+
+//The fill rule needs the pixels to be sampled at their centers, otherwise a whole row of samples lies on the viewport border.
+//Shifting the vertices by half a pixel moves the centers onto the integer grid, so the rest of the pipeline stays the same.
+static glm::i64vec2 snap(const glm::vec4& position) noexcept
+{
+	return glm::i64vec2(glm::round((glm::vec2(position) - glm::vec2(0.5f)) * float(TriangleEdges::FixedPoint::kSubpixelScale)));
+}
+
+//In the screen space Y goes up, so the front-facing triangles are counter-clockwise and the interior lies on the left side of each edge.
+//A left edge goes down, a top edge is horizontal and goes left.
+static bool isTopLeft(int64_t edgeDx, int64_t edgeDy) noexcept
+{
+	return edgeDx > 0 || (edgeDx == 0 && edgeDy < 0);
+}
+
+bool TriangleEdges::Footprint::missesSamples() const noexcept
+{
+	//the samples lie on the integer grid, in the fixed-point mode as well thanks to the half a pixel shift
+	const auto minPoint = glm::min(glm::min(vertices[0], vertices[1]), vertices[2]);
+	const auto maxPoint = glm::max(glm::max(vertices[0], vertices[1]), vertices[2]);
+	const auto minSample = glm::ceil(minPoint);
+	const auto maxSample = glm::floor(maxPoint);
+
+	return minSample.x > maxSample.x || minSample.y > maxSample.y;
+}
+
+TriangleEdges::Footprint TriangleEdges::footprint(const std::array<glm::vec4, 3>& positions, bool fixedPoint) noexcept
+{
+	Footprint result;
+
+	if (fixedPoint)
+	{
+		//the planes are built from the snapped positions to match the integer coverage
+		constexpr auto scale = 1.0f / float(FixedPoint::kSubpixelScale);
+		const std::array<glm::i64vec2, 3> snapped{ snap(positions[0]), snap(positions[1]), snap(positions[2]) };
+
+		const auto bc = snapped[2] - snapped[1];
+		const auto ba = snapped[0] - snapped[1];
+		const auto fixedArea = -bc.y * ba.x + bc.x * ba.y;
+
+		result.vertices = { glm::vec2(snapped[0]) * scale, glm::vec2(snapped[1]) * scale, glm::vec2(snapped[2]) * scale };
+		result.area = float(fixedArea) * scale * scale;
+	}
+	else
+	{
+		result.vertices = { glm::vec2(positions[0]), glm::vec2(positions[1]), glm::vec2(positions[2]) };
+
+		//Sa(a), evaluated the same way as TriangleEdges::edgesAt does
+		const auto bc = result.vertices[2] - result.vertices[1];
+		const auto ba = result.vertices[0] - result.vertices[1];
+		result.area = -bc.y * ba.x + bc.x * ba.y;
+	}
+
+	return result;
+}
+
+void TriangleSetups::setup(size_t idx, const ProjectedTriangles& triangles, size_t triangleIdx, bool fixedPoint) noexcept
+{
+	const auto& indices = triangles.indices[triangleIdx];
+	const auto positions = triangles.trianglePositions(triangleIdx);
+	const std::array<glm::vec3, 3> normals{ triangles.normals[indices.x], triangles.normals[indices.y], triangles.normals[indices.z] };
+	const std::array<glm::vec2, 3> texCoords0{ triangles.texCoords0[indices.x], triangles.texCoords0[indices.y], triangles.texCoords0[indices.z] };
+
+	auto& result = edges[idx];
+	result.fixedPoint = fixedPoint;
+
+	if (fixedPoint)
+	{
+		auto& fixed = result.fixed;
+		fixed.vertices = { snap(positions[0]), snap(positions[1]), snap(positions[2]) };
+
+		const auto bc = fixed.vertices[2] - fixed.vertices[1];
+		const auto ca = fixed.vertices[0] - fixed.vertices[2];
+		const auto ab = fixed.vertices[1] - fixed.vertices[0];
+
+		fixed.edgesDx = { -bc.y, -ca.y, -ab.y };
+		fixed.edgesDy = { bc.x, ca.x, ab.x };
+		fixed.bias =
+		{
+			isTopLeft(fixed.edgesDx.x, fixed.edgesDy.x) ? 0 : -1,
+			isTopLeft(fixed.edgesDx.y, fixed.edgesDy.y) ? 0 : -1,
+			isTopLeft(fixed.edgesDx.z, fixed.edgesDy.z) ? 0 : -1
+		};
+	}
+
+	const auto footprint = TriangleEdges::footprint(positions, fixedPoint);
+	const auto [a, b, c] = footprint.vertices;
+
+	const auto bc = c - b;
+	const auto ca = a - c;
+	const auto ab = b - a;
+
+	result.vertices = footprint.vertices;
+	result.origin = a;
+
+	const auto box = BoundingBox2D{ a, b, c };
+	result.minPixel = glm::ivec2(glm::ceil(box.min()));
+	result.maxPixel = glm::ivec2(glm::ceil(box.max()));
+
+	//Sa(p) = cross(c - b, p - b), Sb(p) = cross(a - c, p - c), Sc(p) = cross(b - a, p - a)
+	result.edgesDx = { -bc.y, -ca.y, -ab.y };
+	result.edgesDy = { bc.x, ca.x, ab.x };
+
+	const auto invArea = footprint.area > 0.0f ? 1.0f / footprint.area : 0.0f;
+	const auto invW = 1.0f / glm::vec3(positions[0].w, positions[1].w, positions[2].w);
+
+	depth[idx] =
+	{
+		makePlane(result.edgesDx, result.edgesDy, invArea, positions[0].z, positions[1].z, positions[2].z),
+		glm::min(glm::min(positions[0].z, positions[1].z), positions[2].z),
+		glm::max(glm::max(positions[0].z, positions[1].z), positions[2].z)
+	};
+
+	attributes[idx] =
+	{
+		makePlane(result.edgesDx, result.edgesDy, invArea, invW.x, invW.y, invW.z),
+		makePlane(result.edgesDx, result.edgesDy, invArea, normals[0] * invW.x, normals[1] * invW.y, normals[2] * invW.z),
+		makePlane(result.edgesDx, result.edgesDy, invArea, texCoords0[0] * invW.x, texCoords0[1] * invW.y, texCoords0[2] * invW.z)
+	};
+}
+
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "glm-include.hpp"
+
+namespace rasterizer {
+
+struct ProjectedTriangles;
+
+//A linear function of the screen position: f(p) = origin + ddx * (p.x - o.x) + ddy * (p.y - o.y)
+template <typename T>
+struct Plane
+{
+	T origin;
+	T ddx;
+	T ddy;
+
+	T at(const glm::vec2& offset) const noexcept
+	{
+		return origin + ddx * offset.x + ddy * offset.y;
+	}
+};
+
+//Everything the binning and the coverage test need to know about a triangle.
+//The planes are relative to the screen position of the first vertex (the origin) to keep float precision at high resolutions.
+struct TriangleEdges
+{
+	std::array<glm::vec2, 3> vertices;
+	glm::vec2 origin;
+
+	//the pixels the triangle may cover, not clamped to the screen
+	glm::ivec2 minPixel;
+	glm::ivec2 maxPixel;
+
+	//three edge functions (the same as Sa, Sb, Sc areas) packed together to be stepped incrementally
+	glm::vec3 edgesDx;
+	glm::vec3 edgesDy;
+
+	//integer edge functions of the vertices snapped to the subpixel grid (see Rasterizer::Options::fixedPointRasterization)
+	struct FixedPoint
+	{
+		static constexpr int kSubpixelBits = 8;
+		static constexpr int64_t kSubpixelScale = int64_t(1) << kSubpixelBits;
+
+		std::array<glm::i64vec2, 3> vertices;
+		glm::i64vec3 edgesDx;	// per subpixel
+		glm::i64vec3 edgesDy;	// per subpixel
+		glm::i64vec3 bias;		// 0 for top-left edges, -1 for the rest, so the pixels on shared edges get rasterized once
+
+		glm::i64vec3 edgesAt(const glm::ivec2& pixel) const noexcept;
+	} fixed;
+	bool fixedPoint;
+
+	glm::vec3 edgesAt(const glm::vec2& point) const noexcept;
+	bool overlaps(const glm::ivec2& rectMin, const glm::ivec2& rectMax) const noexcept;
+	bool covers(const glm::ivec2& rectMin, const glm::ivec2& rectMax) const noexcept;
+
+	//the screen-space vertices and the signed area exactly as the setup sees them, cheap enough to cull triangles beforehand
+	struct Footprint
+	{
+		std::array<glm::vec2, 3> vertices;
+		float area;	// positive for the front-facing triangles
+
+		//whether the bounding box contains no pixel sample at all
+		bool missesSamples() const noexcept;
+	};
+
+	static Footprint footprint(const std::array<glm::vec4, 3>& positions, bool fixedPoint) noexcept;
+};
+
+//what the depth test needs, the planes share the origin of the edges
+struct TriangleDepth
+{
+	//The depths interpolated at the pixels may round past the vertex ones, so the conservative tests against
+	//minDepth and maxDepth leave this much room. It's well above the rounding of a depth plane evaluated
+	//across the screen, the normalized depths are within [0, 1].
+	static constexpr float kMargin = 1.0f / 65536.0f;
+
+	Plane<float> depth;		// normalized Z
+	float minDepth;			// the nearest vertex, any covered pixel lies behind it up to kMargin
+	float maxDepth;			// the farthest vertex, no covered pixel lies behind it beyond kMargin
+};
+
+//what the shading needs for the pixels passing the depth test
+struct TriangleAttributes
+{
+	Plane<float> invW;					// 1 / originalZ
+	Plane<glm::vec3> normalPerW;		// normal / originalZ
+	Plane<glm::vec2> texCoord0PerW;		// texCoord0 / originalZ
+};
+
+//Everything the tiles need to know about the triangles, computed once per triangle instead of once per pixel.
+//The setup is split into streams indexed by the triangle id, so each pass loads only the part it uses:
+//the binning and the coverage test don't touch the interpolated attributes at all.
+struct TriangleSetups
+{
+	std::vector<TriangleEdges> edges;
+	std::vector<TriangleDepth> depth;
+	std::vector<TriangleAttributes> attributes;
+
+	size_t size() const noexcept;
+	void resize(size_t size);
+	void setup(size_t idx, const ProjectedTriangles& triangles, size_t triangleIdx, bool fixedPoint) noexcept;
+};
+
+inline size_t TriangleSetups::size() const noexcept
+{
+	return edges.size();
+}
+
+inline void TriangleSetups::resize(size_t size)
+{
+	edges.resize(size);
+	depth.resize(size);
+	attributes.resize(size);
+}
+
+inline glm::vec3 TriangleEdges::edgesAt(const glm::vec2& point) const noexcept
+{
+	//each edge is evaluated relative to its own vertex, so points lying exactly on the edge yield exactly zero
+	const auto pa = point - vertices[0];
+	const auto pb = point - vertices[1];
+	const auto pc = point - vertices[2];
+
+	return
+	{
+		edgesDx.x * pb.x + edgesDy.x * pb.y,
+		edgesDx.y * pc.x + edgesDy.y * pc.y,
+		edgesDx.z * pa.x + edgesDy.z * pa.y
+	};
+}
+
+inline glm::i64vec3 TriangleEdges::FixedPoint::edgesAt(const glm::ivec2& pixel) const noexcept
+{
+	const auto point = glm::i64vec2(pixel) * kSubpixelScale;
+	const auto pa = point - vertices[0];
+	const auto pb = point - vertices[1];
+	const auto pc = point - vertices[2];
+
+	return glm::i64vec3
+	{
+		edgesDx.x * pb.x + edgesDy.x * pb.y,
+		edgesDx.y * pc.x + edgesDy.y * pc.y,
+		edgesDx.z * pa.x + edgesDy.z * pa.y
+	} + bias;
+}
+
+//Whether any pixel of the rectangle [rectMin, rectMax] may pass the coverage test.
+//The edge functions are linear, so it's enough to test the corner lying the farthest inside of each edge.
+inline bool TriangleEdges::overlaps(const glm::ivec2& rectMin, const glm::ivec2& rectMax) const noexcept
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		if (fixedPoint)
+		{
+			const auto corner = glm::ivec2(fixed.edgesDx[i] > 0 ? rectMax.x : rectMin.x, fixed.edgesDy[i] > 0 ? rectMax.y : rectMin.y);
+			if (fixed.edgesAt(corner)[i] < 0)
+				return false;
+		}
+		else
+		{
+			const auto corner = glm::ivec2(edgesDx[i] > 0.0f ? rectMax.x : rectMin.x, edgesDy[i] > 0.0f ? rectMax.y : rectMin.y);
+			if (edgesAt(glm::vec2(corner))[i] < 0.0f)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+//Whether every pixel of the rectangle [rectMin, rectMax] passes the coverage test.
+//The same as overlaps, but with the corner lying the farthest outside of each edge.
+inline bool TriangleEdges::covers(const glm::ivec2& rectMin, const glm::ivec2& rectMax) const noexcept
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		if (fixedPoint)
+		{
+			const auto corner = glm::ivec2(fixed.edgesDx[i] > 0 ? rectMin.x : rectMax.x, fixed.edgesDy[i] > 0 ? rectMin.y : rectMax.y);
+			if (fixed.edgesAt(corner)[i] < 0)
+				return false;
+		}
+		else
+		{
+			const auto corner = glm::ivec2(edgesDx[i] > 0.0f ? rectMin.x : rectMax.x, edgesDy[i] > 0.0f ? rectMin.y : rectMax.y);
+			if (edgesAt(glm::vec2(corner))[i] < 0.0f)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+}
@@ -0,0 +1,113 @@
+#include "simd.hpp"
+#include "VertexBlock.hpp"
+
+namespace rasterizer {
+
+void VertexBlock::gather(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals, std::vector<VertexBlock>& blocks)
+{
+	blocks.assign((positions.size() + kSize - 1) / kSize, VertexBlock{});
+
+	for (size_t idx = 0; idx != positions.size(); ++idx)
+	{
+		auto& block = blocks[idx / kSize];
+		const auto lane = idx % kSize;
+
+		//a mesh without normals keeps them zero, the same as the vertex buffer it used to leave untouched
+		const auto normal = idx < normals.size() ? normals[idx] : glm::vec3(0.0f);
+		for (int component = 0; component != 3; ++component)
+		{
+			block.positions[component][lane] = positions[idx][component];
+			block.normals[component][lane] = normal[component];
+		}
+	}
+}
+
+#ifdef SIMD_RASTERIZATION
+
+void VertexBlock::transform(
+	size_t count,
+	const glm::mat4& modelViewProjection,
+	const glm::mat3& normalMat,
+	const clipping::planes_t& planes,
+	glm::vec4* positionsOut,
+	glm::vec3* normalsOut,
+	clipping::outcode_t* outcodesOut) const noexcept
+{
+	static_assert(kSize % simd::kWidth == 0, "a block must consist of whole SIMD registers");
+
+	using simd::float_v;
+	const auto broadcast = [](float x) { return float_v::broadcast(x); };
+
+	alignas(32) std::array<row_t, 4> clip;
+	alignas(32) std::array<row_t, 3> normal;
+	std::array<int, std::tuple_size_v<clipping::planes_t>> behindPlane{};
+
+	for (size_t first = 0; first != kSize; first += simd::kWidth)
+	{
+		const auto px = float_v::load(positions[0].data() + first);
+		const auto py = float_v::load(positions[1].data() + first);
+		const auto pz = float_v::load(positions[2].data() + first);
+
+		//the same order of operations as glm's matrix-vector products, w is implicitly one
+		float_v position[4];
+		for (int row = 0; row != 4; ++row)
+		{
+			position[row] =
+				(broadcast(modelViewProjection[0][row]) * px + broadcast(modelViewProjection[1][row]) * py) +
+				(broadcast(modelViewProjection[2][row]) * pz + broadcast(modelViewProjection[3][row]));
+			position[row].store(clip[row].data() + first);
+		}
+
+		for (size_t plane = 0; plane != planes.size(); ++plane)
+		{
+			const auto& p = planes[plane];
+			const auto distance =
+				(broadcast(p.x) * position[0] + broadcast(p.y) * position[1]) +
+				(broadcast(p.z) * position[2] + broadcast(p.w) * position[3]);
+			behindPlane[plane] |= simd::bitmask(simd::negative(distance)) << first;
+		}
+
+		const auto nx = float_v::load(normals[0].data() + first);
+		const auto ny = float_v::load(normals[1].data() + first);
+		const auto nz = float_v::load(normals[2].data() + first);
+
+		for (int row = 0; row != 3; ++row)
+			(broadcast(normalMat[0][row]) * nx + broadcast(normalMat[1][row]) * ny + broadcast(normalMat[2][row]) * nz).store(normal[row].data() + first);
+	}
+
+	for (size_t lane = 0; lane != count; ++lane)
+	{
+		positionsOut[lane] = glm::vec4(clip[0][lane], clip[1][lane], clip[2][lane], clip[3][lane]);
+		normalsOut[lane] = glm::vec3(normal[0][lane], normal[1][lane], normal[2][lane]);
+
+		clipping::outcode_t outcode = 0;
+		for (size_t plane = 0; plane != planes.size(); ++plane)
+			outcode |= clipping::outcode_t((behindPlane[plane] >> lane) & 1) << plane;
+		outcodesOut[lane] = outcode;
+	}
+}
+
+#else
+
+void VertexBlock::transform(
+	size_t count,
+	const glm::mat4& modelViewProjection,
+	const glm::mat3& normalMat,
+	const clipping::planes_t& planes,
+	glm::vec4* positionsOut,
+	glm::vec3* normalsOut,
+	clipping::outcode_t* outcodesOut) const noexcept
+{
+	for (size_t lane = 0; lane != count; ++lane)
+	{
+		const auto position = modelViewProjection * glm::vec4(positions[0][lane], positions[1][lane], positions[2][lane], 1.0f);
+
+		positionsOut[lane] = position;
+		normalsOut[lane] = normalMat * glm::vec3(normals[0][lane], normals[1][lane], normals[2][lane]);
+		outcodesOut[lane] = clipping::computeOutcode(planes, position);
+	}
+}
+
+#endif
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "clipping.hpp"
+#include "glm-include.hpp"
+
+namespace rasterizer {
+
+//The mesh positions and normals regrouped for the vertex stage, kSize vertices per block with every component in its own row.
+//A row loads as whole SIMD registers, so a block is transformed by a few broadcasts and multiply-adds per matrix column
+//instead of a matrix-vector product per vertex. The last block of a mesh is padded with zeros.
+struct alignas(32) VertexBlock
+{
+	static constexpr size_t kSize = 8;
+
+	typedef std::array<float, kSize> row_t;
+
+	std::array<row_t, 3> positions;
+	std::array<row_t, 3> normals;
+
+	static void gather(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals, std::vector<VertexBlock>& blocks);
+
+	//writes the first count vertices of the block to the (AoS) vertex buffer along with their outcodes
+	void transform(
+		size_t count,
+		const glm::mat4& modelViewProjection,
+		const glm::mat3& normalMat,
+		const clipping::planes_t& planes,
+		glm::vec4* positionsOut,
+		glm::vec3* normalsOut,
+		clipping::outcode_t* outcodesOut) const noexcept;
+};
+
+}
@@ -9,67 +9,51 @@ static float isovalue(float first, float second) noexcept
 	return first / (first - second);
 }
 
-triangle_clip_t triangleClip(const glm::vec3& planeDistances) noexcept
+bool clipPolygon(Polygon& polygon, const glm::vec3& planeDistances) noexcept
 {
-	constexpr std::array<glm::vec2, 3> kTriangle{ glm::vec2{ 1.0f, 0.0f }, glm::vec2{ 0.0f, 1.0f }, glm::vec2{ 0.0f, 0.0f } };
+	//the most common case, the whole triangle lies in front of the plane
+	if (planeDistances.x >= 0.0f && planeDistances.y >= 0.0f && planeDistances.z >= 0.0f)
+		return true;
 
-	int nonNegativeValues = 0;
-	int lastNegativeIdx = -1;
-	int lastNonNegativeIdx = -1;
-	for (int i = 0; i < 3; ++i)
-	{
-		if (planeDistances[i] >= 0.0f)
-		{
-			lastNonNegativeIdx = i;
-			nonNegativeValues++;
-		}
-		else
-		{
-			lastNegativeIdx = i;
-		}
-	}
+	if (planeDistances.x < 0.0f && planeDistances.y < 0.0f && planeDistances.z < 0.0f)
+		return false;
 
-	switch (nonNegativeValues)
-	{
-	case 3:
-	{
-		return leaveAsIs{};
-	}
-	case 0:
-	{
-		//discard the whole triangle
-		return discard{};
-	}
-	case 1:
-	case 2:
+	std::array<float, Polygon::kMaxVertices> distances;
+	for (size_t i = 0; i != polygon.count; ++i)
+		distances[i] = interpolate(std::array<float, 3>{ planeDistances.x, planeDistances.y, planeDistances.z }, polygon.vertices[i]);
+
+	Polygon result;
+	result.count = 0;
+
+	//rounding may make an almost degenerate polygon slightly non-convex, so the capacity is checked anyway
+	const auto push = [&result](const glm::vec2& vertex)
 	{
-		const auto curVertex = nonNegativeValues == 1 ? lastNonNegativeIdx : lastNegativeIdx;
-		const auto prevVertex = (curVertex - 1 + 3) % 3;
-		const auto nextVertex = (curVertex + 1) % 3;
-		
-		const auto prevIntersection = isovalue(planeDistances[curVertex], planeDistances[prevVertex]);
-		const auto nextIntersection = isovalue(planeDistances[curVertex], planeDistances[nextVertex]);
+		if (result.count != Polygon::kMaxVertices)
+			result.vertices[result.count++] = vertex;
+	};
 
-		const auto& prevBarycentric = kTriangle[prevVertex];
-		const auto& curBarycentric = kTriangle[curVertex];
-		const auto& nextBarycentric = kTriangle[nextVertex];
+	for (size_t cur = 0; cur != polygon.count; ++cur)
+	{
+		const auto next = cur + 1 == polygon.count ? 0 : cur + 1;
 
-		const auto prevIntBarycentric = glm::lerp(curBarycentric, prevBarycentric, prevIntersection);
-		const auto nextIntBarycentric = glm::lerp(curBarycentric, nextBarycentric, nextIntersection);
+		if (distances[cur] >= 0.0f)
+			push(polygon.vertices[cur]);
 
-		if (nonNegativeValues == 1)
+		//a vertex lying exactly on the plane is emitted as is, without a duplicate intersection
+		if ((distances[cur] > 0.0f && distances[next] < 0.0f) || (distances[cur] < 0.0f && distances[next] > 0.0f))
 		{
-			return std::array<glm::vec2, 3> {prevIntBarycentric, curBarycentric, nextIntBarycentric};
-		}
-		else
-		{
-			return std::array<glm::vec2, 4> {prevBarycentric, prevIntBarycentric, nextIntBarycentric, nextBarycentric};
+			//From the inside endpoint toward the outside one, so the intersection doesn't depend on the polygon's winding.
+			//It lands on the plane only up to the rounding, which decides the coverage of the pixels sampled exactly
+			//on a screen edge, so these may differ from the recursive clipper's output.
+			const auto inside = distances[cur] > 0.0f ? cur : next;
+			const auto outside = inside == cur ? next : cur;
+			push(glm::lerp(polygon.vertices[inside], polygon.vertices[outside], isovalue(distances[inside], distances[outside])));
 		}
 	}
-	}
 
-	std::terminate();
+	polygon = result;
+	return polygon.count >= 3;
 }
 
 }
-}
\ No newline at end of file
+}
@@ -1,26 +1,56 @@
 #pragma once
 
 #include <array>
-#include <atomic>
-#include <variant>
-#include <vector>
+#include <cstdint>
 
 #include "glm-include.hpp"
-#include "Vertex.hpp"
 
 namespace rasterizer {
 namespace clipping {
 
-struct discard
+//homogeneous planes in the clipping space, a point is inside if its distance to every plane is non-negative
+typedef std::array<glm::vec4, 6> planes_t;
+
+//one bit per plane the vertex lies behind
+typedef uint8_t outcode_t;
+
+inline outcode_t computeOutcode(const planes_t& planes, const glm::vec4& position) noexcept
 {
-};
-struct leaveAsIs
+	outcode_t result = 0;
+	for (size_t i = 0; i != planes.size(); ++i)
+		result |= outcode_t(glm::dot(planes[i], position) < 0.0f) << i;
+	return result;
+}
+
+//A convex polygon in the barycentric coordinates of the triangle being clipped.
+//Every plane may add at most one vertex, so six planes turn a triangle into at most 9 vertices.
+struct Polygon
 {
+	static constexpr size_t kMaxVertices = 3 + 6;
+
+	std::array<glm::vec2, kMaxVertices> vertices{ glm::vec2{ 1.0f, 0.0f }, glm::vec2{ 0.0f, 1.0f }, glm::vec2{ 0.0f, 0.0f } };
+	size_t count{ 3 };
+
+	//The triangle vertex the polygon vertex is, or -1 if the clipping created it.
+	//The clipper copies the kept vertices as is, so the comparison is exact.
+	int cornerOf(size_t i) const noexcept;
 };
 
-typedef std::variant<discard, leaveAsIs, std::array<glm::vec2, 3>, std::array<glm::vec2, 4>> triangle_clip_t;
+inline int Polygon::cornerOf(size_t i) const noexcept
+{
+	const auto& vertex = vertices[i];
+	if (vertex == glm::vec2{ 1.0f, 0.0f })
+		return 0;
+	if (vertex == glm::vec2{ 0.0f, 1.0f })
+		return 1;
+	if (vertex == glm::vec2{ 0.0f, 0.0f })
+		return 2;
+	return -1;
+}
 
-triangle_clip_t triangleClip(const glm::vec3& planeDistances) noexcept;
+//Sutherland-Hodgman step. The plane distances are given for the triangle vertices, the distances of the polygon
+//vertices are interpolated from them. Returns false if nothing is left.
+bool clipPolygon(Polygon& polygon, const glm::vec3& planeDistances) noexcept;
 
 template <typename T>
 T interpolate(const typename std::array<T, 3>& props, const glm::vec2& barycentric)
@@ -28,79 +58,29 @@ T interpolate(const typename std::array<T, 3>& props, const glm::vec2& barycentr
 	return props[0] * barycentric.x + props[1] * barycentric.y + props[2] * (1.0f - barycentric.x - barycentric.y);
 }
 
-template <typename TClippingPlanesType>
-struct RecursiveClipper
+//Only the planes the triangle vertices' outcodes mark as crossed take part. Returns false if nothing is left,
+//otherwise the polygon keeps the winding order, so its fan has the same facing as the original triangle.
+inline bool clipTriangle(const std::array<glm::vec4, 3>& positions, const planes_t& planes, outcode_t crossedPlanes, Polygon& polygon) noexcept
 {
-	const std::array<Vertex, 3>& vertices;
-
-	const typename TClippingPlanesType::const_iterator curPlane;
-	const typename TClippingPlanesType::const_iterator endPlane;
-
-	std::atomic_bool& outputLock;
-	std::vector<std::array<Vertex, 3>>& output;
-
-	//discard triangle
-	void operator ()(const discard&)
+	for (size_t i = 0; i != planes.size(); ++i)
 	{
+		if (!(crossedPlanes & (1 << i)))
+			continue;
 
-	}
-	
-	void operator ()(const leaveAsIs&)
-	{
-		std::terminate();
-	}
-
-	void operator ()(const std::array<glm::vec2, 3>& triangle)
-	{
-		const std::array<Vertex, 3> interpolatedTriangle{ interpolate(vertices, triangle[0]), interpolate(vertices, triangle[1]), interpolate(vertices, triangle[2]) };
-
-		triangle_clip_t clippingResult{ leaveAsIs{} };
-		
-		auto plane = curPlane;
-		
-		while (true)
+		const auto& plane = planes[i];
+		const glm::vec3 planeDistances
 		{
-			if (plane == endPlane)
-			{
-				emitTriangle(interpolatedTriangle);
-				return;
-			}
-
-			clippingResult = triangleClip({
-				glm::dot(*plane, interpolatedTriangle[0].position),
-				glm::dot(*plane, interpolatedTriangle[1].position),
-				glm::dot(*plane, interpolatedTriangle[2].position) });
-
-			if (clippingResult.index() != 1)
-				break;
-			plane++;
-		}
-
-		RecursiveClipper clipper
-		{
-			interpolatedTriangle,
-			plane + 1,
-			endPlane,
-			outputLock,
-			output
+			glm::dot(plane, positions[0]),
+			glm::dot(plane, positions[1]),
+			glm::dot(plane, positions[2])
 		};
-		std::visit(clipper, clippingResult);
-	}
 
-	void emitTriangle(const std::array<rasterizer::Vertex, 3>& interpolatedTriangle) noexcept
-	{
-		while (outputLock.exchange(true, std::memory_order::memory_order_acquire)) {};
-		output.emplace_back(interpolatedTriangle);
-		outputLock.store(false, std::memory_order::memory_order_release);
+		if (!clipPolygon(polygon, planeDistances))
+			return false;
 	}
 
-	void operator ()(const std::array<glm::vec2, 4>& quad)
-	{
-		this->operator()(std::array<glm::vec2, 3>{quad[0], quad[1], quad[2]});
-		this->operator()(std::array<glm::vec2, 3>{quad[0], quad[2], quad[3]});
-	}
-};
-
+	return true;
+}
 
 }
-}
\ No newline at end of file
+}
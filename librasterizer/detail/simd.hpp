@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+
+#if !defined(FORCE_SCALAR_RASTERIZATION) && (defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64))
+#define SIMD_RASTERIZATION
+#include <immintrin.h>
+#endif
+
+#ifdef SIMD_RASTERIZATION
+
+namespace rasterizer {
+namespace simd {
+
+//A thin wrapper over the widest available float register. AVX2 processes 8 pixels at once, SSE2 processes 4.
+#ifdef __AVX2__
+
+constexpr size_t kWidth = 8;
+
+struct float_v
+{
+	__m256 v;
+
+	static float_v broadcast(float x) noexcept { return { _mm256_set1_ps(x) }; }
+	static float_v load(const float* ptr) noexcept { return { _mm256_loadu_ps(ptr) }; }
+	void store(float* ptr) const noexcept { _mm256_storeu_ps(ptr, v); }
+};
+
+inline float_v operator+ (float_v a, float_v b) noexcept { return { _mm256_add_ps(a.v, b.v) }; }
+inline float_v operator- (float_v a, float_v b) noexcept { return { _mm256_sub_ps(a.v, b.v) }; }
+inline float_v operator* (float_v a, float_v b) noexcept { return { _mm256_mul_ps(a.v, b.v) }; }
+inline float_v operator/ (float_v a, float_v b) noexcept { return { _mm256_div_ps(a.v, b.v) }; }
+inline float_v operator& (float_v a, float_v b) noexcept { return { _mm256_and_ps(a.v, b.v) }; }
+inline float_v sqrt(float_v a) noexcept { return { _mm256_sqrt_ps(a.v) }; }
+
+//lanes hold all ones where the condition is true
+inline float_v nonNegative(float_v a) noexcept { return { _mm256_cmp_ps(a.v, _mm256_setzero_ps(), _CMP_GE_OQ) }; }
+inline float_v negative(float_v a) noexcept { return { _mm256_cmp_ps(a.v, _mm256_setzero_ps(), _CMP_LT_OQ) }; }
+inline float_v notGreater(float_v a, float_v b) noexcept { return { _mm256_cmp_ps(a.v, b.v, _CMP_NGT_UQ) }; }
+inline float_v select(float_v mask, float_v a, float_v b) noexcept { return { _mm256_blendv_ps(b.v, a.v, mask.v) }; }
+inline int bitmask(float_v mask) noexcept { return _mm256_movemask_ps(mask.v); }
+inline float_v fromBitmask(int bits) noexcept
+{
+	const auto lanes = _mm256_setr_epi32(1 << 0, 1 << 1, 1 << 2, 1 << 3, 1 << 4, 1 << 5, 1 << 6, 1 << 7);
+	return { _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), lanes), lanes)) };
+}
+
+#else
+
+constexpr size_t kWidth = 4;
+
+struct float_v
+{
+	__m128 v;
+
+	static float_v broadcast(float x) noexcept { return { _mm_set1_ps(x) }; }
+	static float_v load(const float* ptr) noexcept { return { _mm_loadu_ps(ptr) }; }
+	void store(float* ptr) const noexcept { _mm_storeu_ps(ptr, v); }
+};
+
+inline float_v operator+ (float_v a, float_v b) noexcept { return { _mm_add_ps(a.v, b.v) }; }
+inline float_v operator- (float_v a, float_v b) noexcept { return { _mm_sub_ps(a.v, b.v) }; }
+inline float_v operator* (float_v a, float_v b) noexcept { return { _mm_mul_ps(a.v, b.v) }; }
+inline float_v operator/ (float_v a, float_v b) noexcept { return { _mm_div_ps(a.v, b.v) }; }
+inline float_v operator& (float_v a, float_v b) noexcept { return { _mm_and_ps(a.v, b.v) }; }
+inline float_v sqrt(float_v a) noexcept { return { _mm_sqrt_ps(a.v) }; }
+
+//lanes hold all ones where the condition is true
+inline float_v nonNegative(float_v a) noexcept { return { _mm_cmpge_ps(a.v, _mm_setzero_ps()) }; }
+inline float_v negative(float_v a) noexcept { return { _mm_cmplt_ps(a.v, _mm_setzero_ps()) }; }
+inline float_v notGreater(float_v a, float_v b) noexcept { return { _mm_cmpngt_ps(a.v, b.v) }; }
+inline float_v select(float_v mask, float_v a, float_v b) noexcept { return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) }; }
+inline int bitmask(float_v mask) noexcept { return _mm_movemask_ps(mask.v); }
+inline float_v fromBitmask(int bits) noexcept
+{
+	const auto lanes = _mm_setr_epi32(1 << 0, 1 << 1, 1 << 2, 1 << 3);
+	return { _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(bits), lanes), lanes)) };
+}
+
+#endif
+
+//origin + ddx * x + ddy * y for every lane
+inline float_v plane(float origin, float ddx, float ddy, float_v x, float_v y) noexcept
+{
+	return float_v::broadcast(origin) + float_v::broadcast(ddx) * x + float_v::broadcast(ddy) * y;
+}
+
+}
+}
+
+#endif
\ No newline at end of file
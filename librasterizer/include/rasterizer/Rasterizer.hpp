@@ -1,11 +1,18 @@
 #pragma once
 
 #include <array>
+#include <optional>
 #include <vector>
 
+#include "../../detail/clipping.hpp"
+#include "../../detail/CoarseBin.hpp"
+#include "../../detail/FrameArena.hpp"
 #include "../../detail/glm-include.hpp"
+#include "../../detail/JobSystem.hpp"
+#include "../../detail/ProjectedTriangles.hpp"
 #include "../../detail/Tile.hpp"
-#include "../../detail/Vertex.hpp"
+#include "../../detail/TriangleSetup.hpp"
+#include "../../detail/VertexBlock.hpp"
 
 #include "gamma_bgra_t.hpp"
 #include "linear_rgba_t.hpp"
@@ -17,7 +24,72 @@ namespace rasterizer {
 class Rasterizer final
 {
 public:
+	enum class CullMode
+	{
+		none,
+		back,
+		front
+	};
+
+	struct Options
+	{
+		//snap the vertices to a 1/256 pixel grid and rasterize with integer edge functions and the top-left fill rule
+		bool fixedPointRasterization{ false };
+		//clip only against near/far and a wide guard band around the screen, the rasterization discards off-screen pixels
+		bool guardBandClipping{ false };
+		//the facing to drop before binning, zero-area triangles and the ones missing all the pixel samples are dropped anyway
+		CullMode cullMode{ CullMode::back };
+		//sort the triangles of each tile by their nearest depth, so the depth test rejects hidden fragments before shading
+		bool frontToBackOrder{ false };
+		//the tile edge in pixels, one of kTileSizes (other values fall back to TILE_SIZE, see CMakeLists.txt)
+		unsigned tileSize{ TILE_SIZE };
+		//time a few frames at every tile size for the current mesh and resolution, then keep the fastest one in tileSize
+		bool autotuneTileSize{ false };
+		//the threads the job system keeps besides the one calling draw, by default one per hardware thread left
+		//(0 runs the whole frame on the calling thread)
+		std::optional<unsigned> workerThreads;
+		//The frames the pipeline works on at once, up to kMaxFramesInFlight. From two on, the geometry of a frame runs
+		//along with the rasterization and the post-processing of an earlier one, and draw outputs the frame started
+		//framesInFlight - 1 calls before. The throughput gain is unmeasured beyond a single core, where there's none.
+		//A resize drops the frames in flight and redoes them at the new size, the animation picks up where the oldest of them started.
+		unsigned framesInFlight{ 1 };
+	};
+
+	static constexpr unsigned kMaxFramesInFlight = 3;
+
+	//counters of the last drawn frame
+	struct Statistics
+	{
+		size_t coarseBinEntries{ 0 };
+		size_t tileBinEntries{ 0 };
+		//entries the triangle bounding boxes produce, but the exact triangle-vs-rectangle test rejects
+		size_t coarseBinEntriesRejected{ 0 };
+		size_t tileBinEntriesRejected{ 0 };
+		//tile entries whose triangle covers the whole tile, they skip the coverage test
+		size_t tileBinEntriesCovering{ 0 };
+		//tile entries dropped at the binning since a later triangle covering the whole tile hides them
+		size_t tileBinEntriesDiscarded{ 0 };
+		//tile entries the hierarchical depth test rejected without rasterizing
+		size_t tileBinEntriesOccluded{ 0 };
+		//fragments that passed the depth test and got shaded, divided by the screen pixels it gives the overdraw
+		size_t shadedFragments{ 0 };
+		//projected triangles dropped by the culling stage
+		size_t culledByFacing{ 0 };
+		size_t culledDegenerate{ 0 };
+		size_t culledMissingSamples{ 0 };
+		//the tile size the frame was rasterized with
+		unsigned tileSize{ 0 };
+		//the workers binning, rasterizing and post-processing the bins, and the busiest one's time divided by the average
+		//of the ones that got any work, 1 is a perfect balance
+		unsigned rasterizationWorkers{ 0 };
+		float rasterizationImbalance{ 1.0f };
+		//the scratch memory the frame took from the frame arena, and the most any frame has taken so far
+		size_t frameArenaBytes{ 0 };
+		size_t frameArenaHighWaterMark{ 0 };
+	};
+
 	Rasterizer() = default;
+	explicit Rasterizer(const Options& options) noexcept;
 	~Rasterizer() = default;
 	Rasterizer(const Rasterizer&) = delete;
 	Rasterizer(Rasterizer&) = delete;
@@ -27,14 +99,23 @@ public:
 
 	void setTexture(Texture texture) noexcept;
 	void setMesh(Mesh mesh) noexcept;
+	void setOptions(const Options& options) noexcept;
+	const Options& options() const noexcept;
+	const Statistics& statistics() const noexcept;
 
 	void draw(unsigned width, unsigned height, std::vector<gamma_bgra_t>& out);
 private:
 	struct Framebuffer
 	{
 		glm::uvec2 screenSize;
+		unsigned tileSize;
 		glm::uvec2 gridDim;
-		std::vector<Tile> grid;
+		//the G-buffer of the tile grid, tile by tile, so every tile's pixels are contiguous (see Tile)
+		std::vector<glm::vec4> color;
+		std::vector<glm::vec3> normal;
+		std::vector<float> depth;
+		glm::uvec2 coarseGridDim;
+		std::vector<CoarseBin> coarseGrid;
 	} m_framebuffer;
 
 	struct PostProcessing
@@ -58,6 +139,19 @@ private:
 		glm::vec3 scale{ 1.0f, 1.0f, 1.0f };
 	} m_parameters;
 
+	Options m_options;
+	Statistics m_statistics;
+
+	struct Autotune
+	{
+		static constexpr size_t kFramesPerSize = 4;	// the first one only warms up the freshly allocated grid
+
+		bool running{ false };
+		size_t candidate{ 0 };
+		size_t frame{ 0 };
+		std::array<double, kTileSizes.size()> milliseconds{};
+	} m_autotune;
+
 	struct Pipeline
 	{
 		struct MatrixState
@@ -65,30 +159,91 @@ private:
 			glm::mat4 viewport;
 			glm::mat4 projection;
 			glm::mat4 modelView;
-			glm::mat4 normal;
+			glm::mat3 normal;
 		} matrices;
 
-		struct VertexStageOutput
+		clipping::planes_t clippingPlanes;
+
+		std::vector<VertexBlock> vertexBlocks;			// per VertexBlock::kSize mesh vertices, regrouped on the first frame after setMesh
+		std::vector<clipping::outcode_t> outcodes;		// per mesh vertex
+
+		struct Clipping
+		{
+			std::vector<glm::uvec2> counts;		// per mesh triangle, the numbers of triangles and new vertices left after clipping
+			std::vector<glm::uvec2> offsets;	// per mesh triangle, the first of its projected triangles and new vertices
+		} clipping;
+
+		ProjectedTriangles projectedTriangles;
+
+		struct Culling
 		{
-			std::vector<glm::vec4> positions;
-			std::vector<glm::vec3> normals;
-		} vertexStageOutput;
+			std::vector<uint8_t> results;				// per projected triangle, see CullResult in Rasterizer.cpp
+			std::vector<size_t> offsets;				// per projected triangle, its place among the visible ones
+			std::vector<glm::uvec3> visibleTriangles;	// swapped with the projected triangle indices after the compaction
+		} culling;
 
-		std::vector<std::array<Vertex, 3>> projectedTriangles;
+		struct Binning
+		{
+			std::vector<uint32_t> entries;				// triangle ids grouped by coarse bins, in the mesh order within a bin
+			CoarseBin::Progress* progress{ nullptr };	// per coarse bin, in the frame arena
+			uint32_t* chunkCounts{ nullptr };			// per chunk of triangles and coarse bin, the entries the chunk has there, in the frame arena
+			uint32_t* chunkOffsets{ nullptr };			// the same layout, the first of the chunk's entries within the bin, in the frame arena
+			std::vector<uint32_t> tileCounts;			// per tile, the number of its triangles
+			std::vector<uint32_t> tileOffsets;			// per tile, the first of its triangles among its bin's tile entries
+			std::vector<size_t> binCosts;				// per coarse bin, the estimated cost of rasterizing it
+			std::vector<uint32_t> schedule;				// coarse bin ids, the heaviest first
+			std::vector<double> workerMilliseconds;		// per worker of the bins, the time it was busy
+		} binning;
 	} m_pipeline;
 
+	//What the front end of a frame (the geometry up to the triangle setup) hands over to its back end (the binning,
+	//the rasterization and the post-processing). With several frames in flight the front end fills one of these
+	//while the back end reads another, the rest of the front end state is its own.
+	struct Frame
+	{
+		Parameters scene;		// as before the front end advanced it, the frame gets redone from here if dropped
+		Pipeline::MatrixState matrices;
+		TriangleSetups triangleSetups;
+
+		//the statistics of the front end, they get published along with the back end ones
+		size_t culledByFacing{ 0 };
+		size_t culledDegenerate{ 0 };
+		size_t culledMissingSamples{ 0 };
+	};
+
+	std::vector<Frame> m_frames;	// a ring of Options::framesInFlight frames
+	size_t m_oldestFrame{ 0 };		// the next one for the back end
+	size_t m_queuedFrames{ 0 };		// past their front end, waiting for the back end
+
+	FrameArena m_frameArena;	// rewound at the start of every frame
+	JobSystem m_jobSystem;		// all the parallel loops of the pipeline run here
+
 
 	Texture m_texture{ 0, 0, {} };
 	Mesh m_mesh{ 0, 0 };
 
+	//Exclusive prefix sum of value(idx) over [0, count) on the job system, calls write(idx, offset) for every idx
+	//and returns the total. The values must be cheap, they are taken twice.
+	template <typename T, typename TValue, typename TWrite>
+	T parallelScan(size_t count, const TValue& value, const TWrite& write);
 	void resetViewport(unsigned width, unsigned height);
+	void restartAutotune() noexcept;
+	void advanceAutotune(double frameMilliseconds) noexcept;
 	void updateScene();
-	void runPipleine();
+	void dropFramesInFlight() noexcept;
+	void runFrontEnd(Frame& frame);
+	void runBackEnd(const Frame& frame, std::vector<gamma_bgra_t>& out);
 	void vertexStage();
 	void clippingStage();
 	void viewportTransformStage();
-	void rasterizationStage();
-	void postProcessingStage();
+	void cullingStage(Frame& frame);
+	void triangleSetupStage(Frame& frame);
+	void rasterizationStage(const Frame& frame);
+	template <typename TTile>
+	void rasterizeBins(const Frame& frame);
+	template <typename TTile>
+	TileCounters rasterizeTile(const Frame& frame, unsigned xTile, unsigned yTile, uint32_t* binTileEntries);
+	void postProcessBin(const Frame& frame, const CoarseBin& bin);
 	void swapBuffers(std::vector<gamma_bgra_t>& out);
 };
 